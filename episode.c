@@ -0,0 +1,77 @@
+#include <stdlib.h>
+
+#include "episode.h"
+#include "util.h"
+
+// directions in clockwise order, and each Dir's index in it
+static const Dir clockwise[] = {UP, RIGHT, DOWN, LEFT};
+static const int clockwise_id[] = {[UP] = 0, [RIGHT] = 1, [DOWN] = 2, [LEFT] = 3};
+
+int encode_turn(Dir prev, Dir d) {
+  return (clockwise_id[d] - clockwise_id[prev]) & 3;
+}
+
+Dir decode_turn(Dir prev, int code) {
+  return clockwise[(clockwise_id[prev] + code) & 3];
+}
+
+/* FNV-1a over head position, reward and engine RNG state of every step.
+ * Two runs of the engine agree on the trajectory iff they agree on this
+ * hash.
+ */
+uint32_t trace_step(uint32_t hash, Board* b, SnakeData* s, int reward) {
+  uint32_t vals[] = {s->start.x, s->start.y, reward, b->rng};
+  for(int i = 0; i < 4; i++) {
+    hash ^= vals[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+void begin_episode(Episode* e, Board* b, uint32_t seed, int food_prob) {
+  e->h = (EpisodeHeader){
+    .magic = EPISODE_MAGIC,
+    .seed = seed,
+    .hash = TRACE_INIT,
+    .size_x = b->size_x,
+    .size_y = b->size_y,
+    .food_prob = food_prob,
+  };
+  e->last = RIGHT;
+}
+
+void record_move(Episode* e, Board* b, SnakeData* s, int reward) {
+  size_t byte = e->h.n_moves / 4;
+  if(byte >= e->cap) {
+    size_t cap = e->cap ? e->cap * 2 : 256;
+    uint8_t* moves = realloc(e->moves, cap);
+    if(moves == NULL) {
+      exit_program("Malloc error");
+    }
+    e->moves = moves;
+    e->cap = cap;
+  }
+  int shift = (e->h.n_moves % 4) * 2;
+  if(shift == 0) e->moves[byte] = 0;
+  e->moves[byte] |= encode_turn(e->last, s->direction) << shift;
+  e->last = s->direction;
+  e->h.n_moves++;
+  e->h.hash = trace_step(e->h.hash, b, s, reward);
+}
+
+void end_episode(Episode* e, SnakeData* s, int lost, FILE* f) {
+  e->h.score = s->tummy;
+  e->h.lost = lost;
+  if(f == NULL) return;
+  size_t n_bytes = (e->h.n_moves + 3) / 4;
+  if(fwrite(&e->h, sizeof(e->h), 1, f) != 1 ||
+     fwrite(e->moves, 1, n_bytes, f) != n_bytes) {
+    exit_program("Could not write episode log");
+  }
+}
+
+void free_episode(Episode* e) {
+  free(e->moves);
+  e->moves = NULL;
+  e->cap = 0;
+}
@@ -0,0 +1,50 @@
+#ifndef EPISODE_H
+#define EPISODE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "snake.h"
+
+#define EPISODE_MAGIC 0x4b4e5343u  // "CSNK"
+#define TRACE_INIT 2166136261u
+
+// limits replay_episodes accepts; the snake spawns at (2..3, 2)
+#define EPISODE_MIN_X 5
+#define EPISODE_MIN_Y 4
+#define EPISODE_MAX_SIZE 1024
+#define EPISODE_MAX_MOVES (1u << 28)
+
+/* On-disk episode: this header followed by (n_moves + 3) / 4 bytes of
+ * moves. Every move is stored in 2 bits as a turn relative to the previous
+ * direction, starting from the RIGHT the snake spawns with.
+ */
+typedef struct {
+  uint32_t magic;
+  uint32_t seed;
+  uint32_t n_moves;
+  uint32_t hash;      // trace_step over the whole trajectory
+  int32_t size_x;
+  int32_t size_y;
+  int32_t food_prob;
+  int32_t score;
+  int32_t lost;
+} EpisodeHeader;
+
+typedef struct {
+  EpisodeHeader h;
+  uint8_t* moves;
+  size_t cap;
+  Dir last;
+} Episode;
+
+int encode_turn(Dir prev, Dir d);
+Dir decode_turn(Dir prev, int code);
+uint32_t trace_step(uint32_t hash, Board* b, SnakeData* s, int reward);
+
+void begin_episode(Episode* e, Board* b, uint32_t seed, int food_prob);
+void record_move(Episode* e, Board* b, SnakeData* s, int reward);
+void end_episode(Episode* e, SnakeData* s, int lost, FILE* f);
+void free_episode(Episode* e);
+
+#endif
@@ -1,17 +1,26 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
-#include <stdarg.h>
-#include <pthread.h>
 #include <termios.h>
-#include <time.h>
-#include <fcntl.h>
 #include <poll.h>
 #include <time.h>
+#include <errno.h>
+#include <stdint.h>
+#include <limits.h>
+#include <math.h>
+#include <sys/timerfd.h>
+
+#include "snake.h"
+#include "episode.h"
+#include "train.h"
+#include "planner.h"
+#include "sweep.h"
+#include "util.h"
 
-#define MAX_FOOD 1
 #define MIN_REFRESH_TIME 1000000L
-#define MAX_EXP_SIZE 100000
+#define INPUT_QUEUE_SIZE 16
+#define MAX_PLAN_STEPS 5000
 
 #define SNAKE_SYMBOL "O"
 #define SNAKE_OPEN_MOUTH "O"
@@ -19,92 +28,15 @@
 #define FlOOR_SYMBOL "."
 #define BORDER_SYMBOL "▣"
 
-#define max(a,b) \
-   ({ __typeof__ (a) _a = (a); \
-       __typeof__ (b) _b = (b); \
-     _a > _b ? _a : _b; })
-
-typedef struct {
-  float** mat;
-  int rows;
-  int cols;
-} Matrix;
-void free_matrix(Matrix* A);
-
-typedef enum {
-  UP = 0,
-  DOWN = 1,
-  LEFT = 2,
-  RIGHT = 3,
-  NIL,
-} Dir;
-
-typedef struct {
-  int x;
-  int y;
-} Point;
-
-typedef struct {
-  Dir **dirMap;
-  Point start;
-  Point end;
-  int tummy;
-  int animation;
-  Dir direction;
-} SnakeData;
-
-typedef enum {
-  Empty,
-  Snake,
-  Food,
-  Border,
-} BoardField;
-
-typedef struct {
-  BoardField **map;
-  int size_x;
-  int size_y;
-  int food;
-} Board;
-
-typedef struct {
-  Matrix* old_state;
-  Matrix* new_state;
-  int reward;
-  int done;
-  Dir move;
-} Exp;
-
-typedef struct {
-  Exp arr[MAX_EXP_SIZE];
-  size_t id;
-} ExpArray;
-
-int loop_back = 0;
-void add_experience(ExpArray* arr, Exp e) {
-  if(loop_back) {
-    free_matrix(arr->arr[arr->id + 1].old_state);
-    free_matrix(arr->arr[arr->id + 1].new_state);
-    free(arr->arr[arr->id + 1].old_state);
-    free(arr->arr[arr->id + 1].new_state);
-  }
-  arr->arr[arr->id++] = e;
-  if(arr->id + 5 >= MAX_EXP_SIZE) {
-    arr->id = 0;
-    loop_back = 1;
-  }
-}
-
-void clear_screen() {
-  printf("\033[H\033[J");
-}
-    
 struct timespec ts = {
   .tv_sec = 0,
   .tv_nsec = 300000000L  // 300 ms
 };
-int updated_time = 1;
 
+/* Raw stdin for the whole run. VMIN = VTIME = 0 makes a read return at
+ * once with whatever is pending, without putting the file description
+ * stdout shares with stdin into non-blocking mode.
+ */
 void set_input_mode(int enable) {
   static struct termios oldt, newt;
 
@@ -114,157 +46,124 @@ void set_input_mode(int enable) {
     tcgetattr(STDIN_FILENO, &oldt); 
     newt = oldt;
     newt.c_lflag &= ~(ICANON | ECHO); 
+    newt.c_cc[VMIN] = 0;
+    newt.c_cc[VTIME] = 0;
     tcsetattr(STDIN_FILENO, TCSANOW, &newt); 
   }
 }
 
-void flush_stdin() {
-  int flags = fcntl(STDIN_FILENO, F_GETFL, 0);
-  fcntl(STDIN_FILENO, F_SETFL, flags | O_NONBLOCK);
-  char tmp;
-  while (read(STDIN_FILENO, &tmp, 1) == 1) { }
-  fcntl(STDIN_FILENO, F_SETFL, flags);
-}
-
-void exit_program(const char* message, ...) {
-  va_list args;
-  va_start(args, message);
-
-  char buffer[512];
-  vsnprintf(buffer, sizeof(buffer), message, args);
-  va_end(args);
-
-  fprintf(stderr, "Error: %s\n", buffer);
+void restore_input_mode() {
   set_input_mode(0);
-  exit(1);
-}
-
-float rand_float(float a, float b) {
-  return a + (b - a) * ((float) rand() / RAND_MAX);
 }
 
-//-----------------------------------------------------------------------------
-
-
-Matrix* alloc_matrix(int n, int m) {
-  Matrix* mat_struct = malloc(sizeof(Matrix));
-  if (!mat_struct) return NULL;
-
-  mat_struct->rows = n;
-  mat_struct->cols = m;
-
-  mat_struct->mat = malloc(n * sizeof(float*));
-  if (!mat_struct->mat) {
-      free(mat_struct);
-      return NULL;
-  }
-  for(int i = 0; i < n; i++) {
-    mat_struct->mat[i] = malloc(m * sizeof(float));
-    if (!mat_struct->mat[i]) {
-      for (int j = 0; j < i; j++) {
-        free(mat_struct->mat[j]);
-      }
-      free(mat_struct->mat);
-      free(mat_struct);
-      return NULL;
+/* Keys pressed between two ticks, oldest first. `escape` tracks how much
+ * of an arrow key sequence (ESC [ A-D) has been seen so far, so sequences
+ * split across reads still parse.
+ */
+typedef struct {
+  Dir keys[INPUT_QUEUE_SIZE];
+  int head;
+  int len;
+  int escape;
+  int quit;
+} InputQueue;
+
+void init_input_queue(InputQueue* q) {
+  q->head = 0;
+  q->len = 0;
+  q->escape = 0;
+  q->quit = 0;
+}
+
+void push_key(InputQueue* q, Dir d) {
+  // when the player is this far ahead of the snake, drop the newest key
+  if(q->len == INPUT_QUEUE_SIZE) return;
+  q->keys[(q->head + q->len) % INPUT_QUEUE_SIZE] = d;
+  q->len++;
+}
+
+void parse_key(InputQueue* q, char c) {
+  if(q->escape == 1) {
+    q->escape = 0;
+    if(c == '[') {
+      q->escape = 2;
+      return;
     }
-  }
-  return mat_struct;
-}
-
-void free_matrix(Matrix* A) {
-  for(int i = 0; i < A->rows; i++) {
-    free(A->mat[i]); 
-  }
-  free(A->mat);
-}
-
-void rand_matrix(Matrix* A, float a, float b) {
-  for(int i = 0; i < A->rows; i++) {
-    for(int j = 0; j < A->cols; j++) {
-      A->mat[i][j] = rand_float(a, b);
+    // a lone Esc, the key after it is a normal key press
+  }
+  if(q->escape == 2) {
+    q->escape = 0;
+    switch(c) {
+      case 'A': push_key(q, UP); break;
+      case 'B': push_key(q, DOWN); break;
+      case 'C': push_key(q, RIGHT); break;
+      case 'D': push_key(q, LEFT); break;
     }
+    return;
   }
-}
-
-void matmul(Matrix* A, Matrix* B, Matrix* C) {
-  if(A->cols != B->rows || C->rows != A->rows || C->cols != B->cols) {
-    exit_program(
-      "Tried to multiply matricies with sizes %dx%d, %dx%d to get matrix %dx%d",
-      A->rows, A->cols, B->rows, B->cols, C->rows, C->cols);
-  }
-
-  for(int i = 0; i < C->rows; i++) {
-    for(int j = 0; j < C->cols; j++) {
-      for(int k = 0; k < A->cols; k++) {
-        C->mat[i][j] += A->mat[i][k] * B->mat[k][j];
-      }
-    }
+  switch(c) {
+    case '\033': q->escape = 1; break;
+    case 'w': push_key(q, UP); break;
+    case 's': push_key(q, DOWN); break;
+    case 'a': push_key(q, LEFT); break;
+    case 'd': push_key(q, RIGHT); break;
+    case 'q': q->quit = 1; break;
   }
 }
 
-void print_matrix(Matrix* A) {
-  printf("%d x %d\n", A->rows, A->cols);
-  for(int i = 0; i < A->rows; i++) {
-    for(int j = 0; j < A->cols; j++) {
-      printf("%f  ", A->mat[i][j]);
-    }
-    printf("\n");
+/* Reads what is pending on stdin into the queue, called once poll says
+ * stdin is readable; poll reports any rest again. Returns 0 once stdin hit
+ * end of file, which is a readable stdin with nothing to read.
+ */
+int read_input(InputQueue* q) {
+  char buf[64];
+  ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+  if(n == 0) return 0;
+  if(n < 0) return errno == EINTR || errno == EAGAIN;
+  for(ssize_t i = 0; i < n; i++) {
+    parse_key(q, buf[i]);
   }
+  return 1;
 }
 
-/* Element-wise adds elements from B to A
+/* Pops keys until one of them is a turn for a snake heading `current`.
+ * Keys that would be no-ops or reversals are thrown away, the rest stay
+ * queued for the following ticks. Returns NIL if there is no turn.
  */
-void elem_add(Matrix* A, Matrix* B) {
-  if(A->cols != B->cols || A->rows != B->rows ) {
-    exit_program(
-      "Tried to add matricies with sizes %dx%d, %dx%d to each other",
-      A->rows, A->cols, B->rows, B->cols);
-  }
-  for(int i = 0; i < A->rows; i++) {
-    for(int j = 0; j < A->cols; j++) {
-      A->mat[i][j] += B->mat[i][j];
-    }
+Dir pop_turn(InputQueue* q, Dir current) {
+  while(q->len > 0) {
+    Dir d = q->keys[q->head];
+    q->head = (q->head + 1) % INPUT_QUEUE_SIZE;
+    q->len--;
+    if(is_valid_turn(current, d)) return d;
   }
+  return NIL;
 }
 
-void copy_matrix(Matrix* A, Matrix* B) {
-  if(A->cols != B->cols || A->rows != B->rows ) {
-    exit_program(
-      "Tried to copy matrix with size %dx%d to %dx%d",
-      A->rows, A->cols, B->rows, B->cols);
-  }
-  for(int i = 0; i < A->rows; i++) {
-    for(int j = 0; j < A->cols; j++) {
-      B->mat[i][j] = A->mat[i][j];
-    }
+void timespec_add(struct timespec* t, struct timespec* d) {
+  t->tv_sec += d->tv_sec;
+  t->tv_nsec += d->tv_nsec;
+  if(t->tv_nsec >= 1000000000L) {
+    t->tv_sec++;
+    t->tv_nsec -= 1000000000L;
   }
 }
 
-void ReLU(Matrix* A) {
-  for(int i = 0; i < A->rows; i++) {
-    for(int j = 0; j < A->cols; j++) {
-      A->mat[i][j] = A->mat[i][j] > 0 ? A->mat[i][j] : 0;
-    }
+/* Arms a periodic CLOCK_MONOTONIC timer whose first tick is at the absolute
+ * time deadline + period. Ticks never drift with input or render time.
+ */
+void arm_tick_timer(int fd, struct timespec* deadline, struct timespec* period) {
+  struct itimerspec its = {
+    .it_interval = *period,
+    .it_value = *deadline,
+  };
+  timespec_add(&its.it_value, period);
+  if(timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, NULL) == -1) {
+    exit_program("timerfd_settime failed");
   }
 }
 
-//-----------------------------------------------------------------------------
-
-int lost_game = 0;
-
-void generate_food(Board*b, int prob) {
-  int make_food = rand() % 100;
-  if(make_food > prob && b->food <= MAX_FOOD) {
-    int new_x = rand() % b->size_x;
-    int new_y = rand() % b->size_y;
-    if(b->map[new_y][new_x] == Snake ||
-       new_y == 0 || new_x == 0 ||
-       new_y == b->size_y-1 || new_x == b->size_x-1) return;
-    b->map[new_y][new_x] = Food;
-    b->food++;
-  }
-}
+//------------------------------------------------------------------------------
 
 void print_field(Board* b, SnakeData* s, int i, int j) {
   switch(b->map[i][j]) {
@@ -287,6 +186,10 @@ void print_field(Board* b, SnakeData* s, int i, int j) {
   }
 }
 
+void clear_screen() {
+  printf("\033[H\033[J");
+}
+
 void print_board(Board* b, SnakeData* s) {
   for(int i = 0; i < b->size_y; i++) {
     for(int j = 0; j < b->size_x; j++) {
@@ -296,239 +199,10 @@ void print_board(Board* b, SnakeData* s) {
   }
 }
 
-void reset_board(Board* b) {
-  b->food = 0;
-  for(int i = 0; i < b->size_y; i++) {
-    for(int j = 0; j < b->size_x; j++) {
-      if(i == 0 || j == 0 || j == b->size_x - 1 || i == b->size_y - 1) {
-        b->map[i][j] = Border;
-      }
-      else {
-        b->map[i][j] = Empty;
-      }
-    }
-  }
-}
-
-void init_empty_board(Board* b, int size_x, int size_y) {
-  b->food = 0;
-  b->size_y = size_y;
-  b->size_x = size_x;
-
-  b->map = malloc(size_y * sizeof(BoardField*));
-  if (b->map == NULL) {
-    fprintf(stderr, "Malloc error for rows\n");
-    exit_program("Malloc error");
-  }
-  
-  for(int i = 0; i < size_y; i++) {
-    b->map[i] = malloc(size_x * sizeof(BoardField));
-    if (b->map[i] == NULL) {
-      fprintf(stderr, "Mallloc error for row: %d\n", i);
-      for(int j = 0; j < i; j++) {
-        exit_program("Malloc error");
-      }
-      free(b->map);
-      exit_program("Malloc error");
-    }
-  }
-  reset_board(b);  
-}
-
-void free_board(Board* b) {
-  if(b->map != NULL) {
-    for(int i = 0; i < b->size_y; i++) {
-      free(b->map[i]);
-    }
-    free(b->map);
-  }
-}
-
-Matrix* board_to_matrix(Board* b) {
-  Matrix* mat = malloc(sizeof(Matrix));
-  mat = alloc_matrix(b->size_y, b->size_x);
-  for(int i = 0; i < mat->rows; i++) {
-    for(int j = 0; j < mat->cols; j++) {
-      switch(b->map[i][j]) {
-        case Border:
-          mat->mat[i][j] = -1.0;
-          break;
-        case Snake:
-          mat->mat[i][j] = 1.0;
-          break;
-        case Empty:
-          mat->mat[i][j] = 0.0;
-          break;
-        case Food:
-          mat->mat[i][j] = 1.0;
-          break;
-      }
-    }
-  }
-  return mat;
-}
-
-// ============================================================================
-
-void reset_snake(SnakeData* snake, Board* b) {
-  snake->start = (Point){.x = 3, .y = 2};
-  snake->end = (Point){.x = 2, .y = 2};
-  snake->direction = RIGHT;
-  snake->tummy = 0;
-  snake->animation = 0;
-
-  for(int i = 0; i < b->size_y; i++) {
-    for(int j = 0; j < b->size_x; j++) {
-      snake->dirMap[i][j] = NIL;
-    }
-  }
-
-  Point snake_body = snake->end;
-  while(snake_body.x != snake->start.x || snake_body.y != snake->start.y) {
-    snake->dirMap[snake_body.y][snake_body.x] = snake->direction;  
-    b->map[snake_body.y][snake_body.x] = Snake;  
-    switch(snake->direction) {
-      case RIGHT:
-        snake_body.x++;
-        break;
-      default:
-        printf("unsupported direction %c\n", snake->direction);
-        //exit(1);
-    }
-  }
-
-  b->map[snake_body.y][snake_body.x] = Snake;
-  snake->dirMap[snake_body.y][snake_body.x] = snake->direction; 
-}
-
-void init_snake(SnakeData* snake, Board* b) {
-
-  snake->dirMap = malloc(b->size_y * sizeof(Dir*));
-  if(snake->dirMap == NULL) {
-    fprintf(stderr, "Malloc error for rows\n");
-    exit_program("Malloc error");
-  }
-  
-  for(int i = 0; i < b->size_y; i++) {
-    snake->dirMap[i] = malloc(b->size_x * sizeof(Dir));
-    if (b->map[i] == NULL) {
-      fprintf(stderr, "Mallloc error for row: %d\n", i);
-      for(int j = 0; j < i; j++) {
-        free(snake->dirMap[j]);
-      }
-      free(snake->dirMap);
-      exit_program("Malloc error");
-    }
-  }
- 
-  reset_snake(snake, b);
-}
-
-void free_snake(SnakeData* s, int board_size_y) {
-  if(s->dirMap != NULL) {
-    for(int i = 0; i < board_size_y; i++) {
-      free(s->dirMap[i]);
-    }
-    free(s->dirMap);
-  }
-}
-
-int update_snake(SnakeData* s, Board* b) {
-  s->animation = s->animation == 0 ? 1 : 0;
-  // change the direction at the turn
-  s->dirMap[s->start.y][s->start.x] = s->direction; 
-  // snake head
-  switch(s->direction) {
-    case RIGHT:
-      s->start.x++;
-      break;
-    case LEFT:
-      s->start.x--;
-      break;
-    case DOWN:
-      s->start.y++;
-      break;
-    case UP:
-      s->start.y--;
-      break;
-    default:
-      printf("unsupported direction %c\n", s->direction);
-  }
-  if(s->start.x >= b->size_x || s->start.x < 0 || 
-     s->start.y >= b->size_y || s->start.y < 0) {
-    // we went out of bounds
-    exit_program("snake went out of bounds");
-  }
-  s->dirMap[s->start.y][s->start.x] = s->direction; 
-  if(b->map[s->start.y][s->start.x] == Snake ||
-      b->map[s->start.y][s->start.x] == Border) {
-    //exit_program("snake eating itself!");
-    lost_game = 1;
-    return -500;
-  }
-  int ate = 0;
-  if(b->map[s->start.y][s->start.x] == Food) {
-    ate = 1;
-    updated_time = 0;
-    s->tummy++;
-    b->food--;
-  }
-  b->map[s->start.y][s->start.x] = Snake;
-
-  // if we ate food we make our snake longer by not reducing tail this frame
-  if(ate) return 100;
-  // snake butt
-  Point old_end = s->end;
-  b->map[s->end.y][s->end.x] = Empty;
-  switch(s->dirMap[s->end.y][s->end.x]) {
-    case RIGHT:
-      s->end.x++;
-      break;
-    case LEFT:
-      s->end.x--;
-      break;
-    case DOWN:
-      s->end.y++;
-      break;
-    case UP:
-      s->end.y--;
-      break;
-    case NIL:
-      break;
-    default:
-      printf("unsupported direction %c\n", s->direction);
-  }
-  s->dirMap[old_end.y][old_end.x] = NIL;
-  return -1;
-}
-
-void set_snake_direction(char c, SnakeData* s) {
-  switch(c) {
-    case 'd':
-      if(s->direction != LEFT)
-        s->direction = RIGHT;
-      break;
-    case 'a':
-      if(s->direction != RIGHT)
-        s->direction = LEFT;
-      break;
-    case 'w':
-      if(s->direction != DOWN)
-        s->direction = UP;
-      break;
-    case 's':
-      if(s->direction != UP)
-        s->direction = DOWN;
-      break;
-    default:
-      printf("unsupported input: %c\n", c);
-  }
-}
-
 void print_snake_directions(SnakeData* s, Board* b) {
   for(int i = 0; i < b->size_y; i++) {
     for(int j = 0; j < b->size_x; j++) {
-      char c;
+      char c = '?';
       switch(s->dirMap[i][j]) {
         case RIGHT:
           c = 'R';
@@ -554,380 +228,409 @@ void print_snake_directions(SnakeData* s, Board* b) {
   }
 }
 
-// ============================================================================
-
-
-
-// ============================================================================
-
-char dir_to_char(Dir m) {
-  switch(m) {
-    case LEFT:
-      return 'a';
-      break;
-    case RIGHT:
-      return 'd';
-      break;
-    case UP:
-      return 'w';
-      break;
-    case DOWN:
-      return 's';
-      break;
-    case NIL:
-      return 'a';
-      break;
-  }
-  return 'a';
+void render_game(Board* b, SnakeData* s) {
+  clear_screen();
+  print_board(b, s);
+  printf("player score: %d\n", s->tummy);
+  printf("food on board: %d\n", b->food);
+  printf("current refresh rate: %ld\n", ts.tv_nsec);
+  //print_snake_directions(s, b);
+  fflush(stdout);
 }
 
-void reset_env(Board* b, SnakeData* s) {
-  reset_board(b);
-  reset_snake(s, b);
+void render_training(Board* b, SnakeData* s, int iter, Dir move) {
+  clear_screen();
+  printf("iteration %d\n", iter);
+  print_board(b, s);
+  printf("Snake made move: %c\n", dir_to_char(move));
+  fflush(stdout);
 }
 
-Dir e_greedy() {
-  int p = (rand() % 100) % 4;
-  switch(p) {
-    case 0:
-      return LEFT;
-    case 1:
-      return RIGHT;
-    case 2:
-      return UP;
-    case 3:
-      return DOWN;
-  }
-  return DOWN;
-}
-
-void execute_move(SnakeData *s, Dir move) {
-  set_snake_direction(dir_to_char(move), s); 
-}
+/* Input, simulation and rendering are driven by poll on stdin and a tick
+ * timer. The snake moves exactly once per timer tick, whatever the input
+ * rate or terminal speed.
+ */
+void main_loop(FILE* episode_log) {
+  Board b;
+  init_empty_board(&b, 10, 10);
+  SnakeData snake;
+  init_snake(&snake, &b);
+  uint32_t seed = rand();
+  start_episode(&b, &snake, seed);
 
-ExpArray replay_buffer;
+  Episode episode = {0};
+  begin_episode(&episode, &b, seed, 40);
 
+  int timer = timerfd_create(CLOCK_MONOTONIC, 0);
+  if(timer == -1) {
+    exit_program("timerfd_create failed");
+  }
+  struct timespec deadline;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  arm_tick_timer(timer, &deadline, &ts);
 
-//------------------------------------------------------------------------------
+  InputQueue input;
+  init_input_queue(&input);
 
-void main_loop() {
-  struct pollfd fds[1];
+  struct pollfd fds[2];
   fds[0].fd = STDIN_FILENO;
   fds[0].events = POLLIN;
+  fds[1].fd = timer;
+  fds[1].events = POLLIN;
 
-  Board b;
-  init_empty_board(&b, 10, 10);
-  b.map[4][4] = Food;
-  SnakeData snake;
-  init_snake(&snake, &b);
-
-  for(;;) { 
-    clear_screen();
+  render_game(&b, &snake);
 
-    int ret = poll(fds, 1, 50);
+  int quit = 0;
+  while(!quit) { 
+    int ret = poll(fds, 2, -1);
 
     if (ret == -1) {
-        perror("poll");
-    } else if (ret == 0) {
-    } else if (fds[0].revents & POLLIN) {
-      char c = getchar();
-      flush_stdin();
-      if(c == 'w' || c == 's' || c == 'a' || c == 'd') set_snake_direction(c, &snake);
-      if(c == 'q') {
+      if(errno != EINTR) perror("poll");
+      continue;
+    }
+
+    if (fds[0].revents & (POLLIN | POLLHUP)) {
+      // stop polling a closed stdin, the game keeps running
+      if(!read_input(&input)) fds[0].fd = -1;
+      if(input.quit) {
         print_board(&b, &snake);
         //print_snake_directions(&snake, &b);
         break;
       }
     }
 
-    update_snake(&snake, &b);
-    if(snake.tummy % 4 == 0 && !updated_time) {
-      ts.tv_nsec -= 20000000;
-      ts.tv_nsec = max(ts.tv_nsec, MIN_REFRESH_TIME);
-      updated_time = 1;
-    }
-    if(lost_game) {
-      print_board(&b, &snake);
-      printf("Lost game!\n");
-      return;
+    if (fds[1].revents & POLLIN) {
+      uint64_t ticks;
+      if(read(timer, &ticks, sizeof(ticks)) != sizeof(ticks)) continue;
+
+      // catch up on ticks missed while rendering was slow, draw once
+      for(uint64_t i = 0; i < ticks; i++) {
+        timespec_add(&deadline, &ts);
+        Dir turn = pop_turn(&input, snake.direction);
+        if(turn != NIL) snake.direction = turn;
+        int reward = update_snake(&snake, &b);
+        record_move(&episode, &b, &snake, reward);
+        if(snake.dead) {
+          print_board(&b, &snake);
+          printf("Lost game!\n");
+          quit = 1;
+          break;
+        }
+        generate_food(&b, 40);
+        if(snake.ate && snake.tummy % 4 == 0) {
+          ts.tv_nsec -= 20000000;
+          ts.tv_nsec = max(ts.tv_nsec, MIN_REFRESH_TIME);
+          arm_tick_timer(timer, &deadline, &ts);
+          break;
+        }
+      }
+      if(!quit) render_game(&b, &snake);
     }
-    generate_food(&b, 40);
-
-    print_board(&b, &snake);
-    printf("player score: %d\n", snake.tummy);
-    printf("food on board: %d\n", b.food);
-    printf("current refresh rate: %ld\n", ts.tv_nsec);
-    //print_snake_directions(&snake, &b);
-    nanosleep(&ts, NULL);
   }
 
+  end_episode(&episode, &snake, snake.dead, episode_log);
+  free_episode(&episode);
+
+  close(timer);
   free_snake(&snake, b.size_y);
   free_board(&b);
 }
 
-
-// ============================================================================
-
-typedef struct {
-  Matrix* W_1; 
-  Matrix* b_1;
-  Matrix* W_2;
-  Matrix* b_2;
-  int hidden;
-} Model;
-
-void init_model(Model* m, int hidden) {
-  m->hidden = hidden;
-  m->W_1 = alloc_matrix(hidden, 100);
-  m->b_1 = alloc_matrix(hidden, 1);
-  m->W_2 = alloc_matrix(4, hidden);
-  m->b_2 = alloc_matrix(4, 1);
-
-  rand_matrix(m->W_1, 0.0, 1.0);
-  rand_matrix(m->b_1, 0.0, 1.0);
-  rand_matrix(m->W_2, 0.0, 1.0);
-  rand_matrix(m->b_2, 0.0, 1.0);
-}
-
-void free_model(Model* m) {
-  free_matrix(m->W_1);
-  free_matrix(m->b_1);
-  free_matrix(m->W_2);
-  free_matrix(m->b_2);
-}
-
-Matrix* flatten(Matrix* A) {
-  Matrix* x = alloc_matrix(A->rows * A->cols, 1);
-  for(int i = 0; i < A->rows; i++) {
-    for(int j = 0; j < A->cols; j++) {
-      x->mat[i * A->cols + j][0] = A->mat[i][j];
+/* Plays n games with the Monte-Carlo planner and reports its score and
+ * how many engine steps per second the lookahead ran.
+ */
+void run_planner(int n_games, FILE* episode_log, int verbose) {
+  Board b;
+  init_empty_board(&b, 10, 10);
+  SnakeData snake;
+  init_snake(&snake, &b);
+  Planner planner;
+  init_planner(&planner, &b, rand());
+
+  long moves = 0;
+  long score = 0;
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for(int game = 0; game < n_games; game++) {
+    uint32_t seed = rand();
+    start_episode(&b, &snake, seed);
+    Episode episode = {0};
+    begin_episode(&episode, &b, seed, planner.food_prob);
+
+    // a planner that never dies would otherwise circle forever
+    for(int step = 0; step < MAX_PLAN_STEPS && !snake.dead; step++) {
+      snake.direction = plan_move(&planner, &b, &snake);
+      int reward = update_snake(&snake, &b);
+      record_move(&episode, &b, &snake, reward);
+      generate_food(&b, planner.food_prob);
+      moves++;
+
+      if(verbose) {
+        render_game(&b, &snake);
+        printf("game %d, move %d\n", game, step);
+        nanosleep(&ts, NULL);
+      }
     }
+    score += snake.tummy;
+    end_episode(&episode, &snake, snake.dead, episode_log);
+    free_episode(&episode);
   }
-  return x;
-}
-
-Matrix* forward(Model* m, Matrix* X) {
-  Matrix* X_flat = flatten(X);
-  Matrix* x_1 = alloc_matrix(m->hidden, 1);
-  Matrix* out = alloc_matrix(4, 1);
-
-  matmul(m->W_1, X_flat, x_1);
-  elem_add(x_1, m->b_1);
-  ReLU(x_1);
 
-  matmul(m->W_2, x_1, out);
-  elem_add(out, m->b_2);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+  printf("%d games, mean score %.2f, %ld moves, %ld simulated steps "
+         "(%.0f steps/s, %.0f per move)\n",
+         n_games, (double)score / max(n_games, 1), moves, planner.sim_steps,
+         planner.sim_steps / (secs > 0 ? secs : 1e-9),
+         (double)planner.sim_steps / max(moves, 1L));
 
-  free_matrix(X_flat);
-  free_matrix(x_1);
-  free(X_flat);
-  free(x_1);
-  return out;
+  free_planner(&planner);
+  free_snake(&snake, b.size_y);
+  free_board(&b);
 }
 
-Dir get_best_move(Matrix* out, float eps) {
-  Dir moves[] = {UP, DOWN, LEFT, RIGHT};
-  float exploration = rand_float(0.0, 1.0);
-  
-  if(exploration > eps) {
-    return moves[rand() % 4];
-  } else {
-    float max_val = out->mat[0][0];
-    int max_id = 0;
-    for(int i = 1; i < 4; i++) {
-      if(out->mat[i][0] > max_val) {
-        max_id = i;
-        max_val = out->mat[i][0];
+/* Re-simulates every episode of a log through the engine and checks that
+ * the trajectory, score and outcome match the recording. Returns the
+ * number of episodes that diverged.
+ */
+int replay_episodes(const char* path, int verbose) {
+  FILE* f = fopen(path, "rb");
+  if(f == NULL) {
+    exit_program("Could not open episode log %s", path);
+  }
+
+  int episodes = 0;
+  int mismatches = 0;
+  long total_moves = 0;
+  uint8_t* moves = NULL;
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  EpisodeHeader h;
+  while(fread(&h, sizeof(h), 1, f) == 1) {
+    if(h.magic != EPISODE_MAGIC) {
+      exit_program("%s is not an episode log", path);
+    }
+    if(h.size_x < EPISODE_MIN_X || h.size_y < EPISODE_MIN_Y ||
+       h.size_x > EPISODE_MAX_SIZE || h.size_y > EPISODE_MAX_SIZE) {
+      exit_program("Episode %d in %s has a %dx%d board", episodes, path,
+                   h.size_x, h.size_y);
+    }
+    if(h.food_prob < -1 || h.food_prob > 100) {
+      exit_program("Episode %d in %s has food probability %d", episodes, path,
+                   h.food_prob);
+    }
+    if(h.n_moves > EPISODE_MAX_MOVES) {
+      exit_program("Episode %d in %s has %u moves", episodes, path, h.n_moves);
+    }
+    size_t n_bytes = (h.n_moves + 3) / 4;
+    uint8_t* grown = realloc(moves, n_bytes + 1);
+    if(grown == NULL) {
+      free(moves);
+      exit_program("Malloc error");
+    }
+    moves = grown;
+    if(fread(moves, 1, n_bytes, f) != n_bytes) {
+      exit_program("Truncated episode %d in %s", episodes, path);
+    }
+
+    Board b;
+    init_empty_board(&b, h.size_x, h.size_y);
+    SnakeData snake;
+    init_snake(&snake, &b);
+    start_episode(&b, &snake, h.seed);
+
+    uint32_t hash = TRACE_INIT;
+    uint32_t n = 0;
+    while(n < h.n_moves && !snake.dead) {
+      int code = (moves[n / 4] >> ((n % 4) * 2)) & 3;
+      snake.direction = decode_turn(snake.direction, code);
+      int reward = update_snake(&snake, &b);
+      hash = trace_step(hash, &b, &snake, reward);
+      generate_food(&b, h.food_prob);
+      n++;
+
+      if(verbose) {
+        render_game(&b, &snake);
+        printf("episode %d, move %u/%u\n", episodes, n, h.n_moves);
+        nanosleep(&ts, NULL);
       }
     }
-    return moves[max_id];
-  }
-}
 
-float max_reward(Matrix* Q) {
-  float max_r = 0.0;
-  for(int i = 0; i < Q->rows; i++) {
-    if(Q->mat[i][0] > max_r) {
-      max_r = Q->mat[i][0];
+    if(n != h.n_moves || hash != h.hash ||
+       snake.tummy != h.score || snake.dead != h.lost) {
+      printf("episode %d diverged after %u/%u moves (score %d, recorded %d)\n",
+             episodes, n, h.n_moves, snake.tummy, h.score);
+      mismatches++;
     }
-  }
-  return max_r;
-}
+    total_moves += n;
+    episodes++;
 
-void backward(Model* m, ExpArray* rep_buffer) {
-  float gamma = 0.3;
-  float lr = 0.1;
-  // get random memory and calculate loss
-  Exp* batch = &rep_buffer->arr[rand() % rep_buffer->id];
-  //Matrix* Q_pred = forward(m, batch->old_state);
-  Matrix* X_flat = flatten(batch->old_state);
-  Matrix* x_1 = alloc_matrix(m->hidden, 1);
-  Matrix* x_1_act = alloc_matrix(m->hidden, 1);
-
-  matmul(m->W_1, X_flat, x_1);
-  elem_add(x_1, m->b_1);
-  copy_matrix(x_1, x_1_act);
-  ReLU(x_1_act);
-
-  Matrix* Q_pred = alloc_matrix(4, 1);
-  matmul(m->W_2, x_1, Q_pred);
-  elem_add(Q_pred, m->b_2);
-
-  float Q_sa = Q_pred->mat[batch->move][0];
-  float target = 0.0;
-
-  if(batch->done) {
-    target = batch->reward;
-  } else {
-    Matrix* Q_new = forward(m, batch->new_state);
-    float max_Q_new = max_reward(Q_new); 
-    target = batch->reward + gamma * max_Q_new;
-    free_matrix(Q_new);
-    free(Q_new);
+    free_snake(&snake, b.size_y);
+    free_board(&b);
   }
 
-  //float loss = (Q_sa - target) * (Q_sa - target);
-  // do gradient descent
-  int a = batch->move;
-  float l_d = 2 * (Q_sa - target);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+  printf("replayed %d episodes, %ld moves in %.3fs (%.0f moves/s), %d diverged\n",
+         episodes, total_moves, secs, total_moves / (secs > 0 ? secs : 1e-9),
+         mismatches);
 
-  // W_2, b_2
-  for(int i = 0; i < 4; i++) {
-    for(int j = 0; j < m->hidden; j++) {
-      float grad = (i == a ? 1.0f : 0.0f) * l_d * x_1_act->mat[j][0];
-      m->W_2->mat[i][j] -= lr * grad;
-    }
-    float grad_b = (i == a ? 1.0f : 0.0f) * l_d;
-    m->b_2->mat[i][0] -= lr * grad_b;
-  }
-  
-  // propagate through ReLU
-  Matrix* delta1 = alloc_matrix(m->hidden, 1); // dL/dx1
-
-  for(int j = 0; j < m->hidden; j++) {
-    float grad = m->W_2->mat[a][j] * l_d;
-    // pochodna ReLU
-    if(x_1->mat[j][0] <= 0.0f) grad = 0.0f;
-    delta1->mat[j][0] = grad;
-  }
+  free(moves);
+  fclose(f);
+  return mismatches;
+}
 
-  // W_1, b_1
-  for(int i = 0; i < m->hidden; i++) {
-    for(int j = 0; j < X_flat->rows; j++) {
-      float grad = delta1->mat[i][0] * X_flat->mat[j][0];
-      m->W_1->mat[i][j] -= lr * grad;
-    }
-    m->b_1->mat[i][0] -= lr * delta1->mat[i][0];
+/* Episode or game count from the command line. Returns 0 unless the whole
+ * argument is a positive number that fits an int.
+ */
+int parse_count(const char* arg) {
+  char* end;
+  errno = 0;
+  long n = strtol(arg, &end, 10);
+  if(end == arg || *end != '\0' || errno != 0 || n <= 0 || n > INT_MAX) {
+    return 0;
   }
-   
-  free_matrix(delta1);
-  free_matrix(Q_pred);
-  free_matrix(X_flat);
-  free_matrix(x_1);
-  free_matrix(x_1_act);
-  free(delta1);
-  free(Q_pred);
-  free(X_flat);
-  free(x_1);
-  free(x_1_act);
+  return (int)n;
 }
 
-Model* model;
-float exploration = 0.5;
-int batch_size = 7;
-
-void run_simulation(Board* b, SnakeData *s, int verbose, int iter) {
-  while(!lost_game) {
-    Matrix *s_before = board_to_matrix(b);
-    Matrix *out = alloc_matrix(4, 1);
-
-    out = forward(model, s_before);
-    Dir move = get_best_move(out, exploration);
-    exploration *= 0.9999;
+/* Positive finite float from the command line, or 0 on bad input.
+ */
+float parse_rate(const char* arg) {
+  char* end;
+  float v = strtof(arg, &end);
+  if(end == arg || *end != '\0' || !isfinite(v) || v <= 0.0f) return 0.0f;
+  return v;
+}
 
-    execute_move(s, move);
-    int reward = update_snake(s, b);
-    int done = lost_game;
-    generate_food(b, 10);
+/* A full disk may only show up when the buffered tail is flushed.
+ */
+void close_log(FILE* f) {
+  if(f != NULL && fclose(f) != 0) {
+    exit_program("Could not write episode log");
+  }
+}
+
+void usage(const char* prog) {
+  fprintf(stderr,
+    "usage: %s [-r LOG]              play, optionally recording to LOG\n"
+    "       %s train N [-r LOG] [-t CSV] [-c] [--hidden WIDTHS] [--lr LR] [-v]\n"
+    "                               train headless for N episodes, writing\n"
+    "                               telemetry to CSV, -c for a conv network,\n"
+    "                               WIDTHS like 64x32 for the MLP layers,\n"
+    "                               -v to watch every move\n"
+    "       %s replay LOG [-v]       re-simulate and verify a log\n"
+    "       %s plan N [-r LOG] [-v]  play N games with the lookahead planner\n"
+    "       %s sweep N [-o DIR] [-j WORKERS] [--hidden LIST] [--decay LIST]\n"
+    "             [--batch LIST] [--gamma LIST] [--lr LIST]\n"
+    "                               train every combination of the comma\n"
+    "                               separated lists for N episodes in parallel,\n"
+    "                               hidden shapes as WIDTHS, e.g. 64x32,48\n",
+    prog, prog, prog, prog, prog);
+  exit(1);
+}
 
-    Matrix* s_after = board_to_matrix(b);
+int main(int argc, char** argv) {
+  srand(time(NULL));
 
-    Exp new_experience = {.old_state=s_before, .new_state=s_after, 
-                          .done=done, .reward=reward, .move=move};
+  Trainer trainer;
+  init_trainer(&trainer);
 
-    add_experience(&replay_buffer, new_experience);
+  const char* mode = "play";
+  const char* log_path = NULL;
+  int n_iters = 0;
+  int verbose = 0;
 
-    int batch = replay_buffer.id < batch_size ? replay_buffer.id : batch_size;
-    for(int i = 0; i < batch; i++) {
-      backward(model, &replay_buffer);
+  int arg = 1;
+  if(arg < argc && strcmp(argv[arg], "sweep") == 0) {
+    Sweep sw;
+    if(arg + 1 >= argc ||
+       !parse_sweep(&sw, &trainer, argc - arg - 2, argv + arg + 2)) {
+      usage(argv[0]);
     }
-
-    if(verbose) {
-      clear_screen();
-      printf("iteration %d\n", iter);
-      print_board(b, s);
-      printf("Snake made move: %c\n", dir_to_char(move));
-      nanosleep(&ts, NULL);
+    sw.n_iters = parse_count(argv[arg + 1]);
+    if(sw.n_iters == 0) usage(argv[0]);
+    free_trainer(&trainer);
+    return run_sweep(&sw) == 0 ? 0 : 1;
+  }
+  if(arg < argc && (strcmp(argv[arg], "train") == 0 ||
+                    strcmp(argv[arg], "plan") == 0)) {
+    if(arg + 1 >= argc) usage(argv[0]);
+    mode = argv[arg];
+    n_iters = parse_count(argv[arg + 1]);
+    if(n_iters == 0) usage(argv[0]);
+    arg += 2;
+  } else if(arg < argc && strcmp(argv[arg], "replay") == 0) {
+    if(arg + 1 >= argc) usage(argv[0]);
+    mode = argv[arg];
+    log_path = argv[arg + 1];
+    arg += 2;
+  }
+  // options only apply to the modes listed in the usage
+  int training = strcmp(mode, "train") == 0;
+  int replaying = strcmp(mode, "replay") == 0;
+  int playing = strcmp(mode, "play") == 0;
+  for(; arg < argc; arg++) {
+    if(strcmp(argv[arg], "-r") == 0 && arg + 1 < argc && !replaying) {
+      log_path = argv[++arg];
+    } else if(strcmp(argv[arg], "-t") == 0 && arg + 1 < argc && training) {
+      trainer.telemetry.out = fopen(argv[++arg], "a");
+      if(trainer.telemetry.out == NULL) {
+        exit_program("Could not open telemetry file %s", argv[arg]);
+      }
+    } else if(strcmp(argv[arg], "-c") == 0 && training) {
+      trainer.conv_net = 1;
+    } else if(strcmp(argv[arg], "--hidden") == 0 && arg + 1 < argc && training) {
+      trainer.depth = parse_widths(argv[++arg], trainer.hidden);
+      if(trainer.depth == 0) usage(argv[0]);
+    } else if(strcmp(argv[arg], "--lr") == 0 && arg + 1 < argc && training) {
+      trainer.lr = parse_rate(argv[++arg]);
+      if(!(trainer.lr > 0.0f)) usage(argv[0]);
+    } else if(strcmp(argv[arg], "-v") == 0 && !playing) {
+      verbose = 1;
+    } else {
+      usage(argv[0]);
     }
-    free_matrix(out);
   }
-  lost_game = 0;
-  return;
-}
-
-/* 
- * model 
- * params
- */
-void train(int n_iters, int verbose) {
-  Board b;
-  init_empty_board(&b, 10, 10);
-  SnakeData snake;
-  init_snake(&snake, &b);
 
-  replay_buffer.id = 0;
-
-  model = malloc(sizeof(Model));
-  init_model(model, 48);
-
-  int log_every = (int)(n_iters / 10);
+  if(strcmp(mode, "replay") == 0) {
+    free_trainer(&trainer);
+    return replay_episodes(log_path, verbose) == 0 ? 0 : 1;
+  }
 
-  for(int iter = 1; iter <= n_iters; iter++) {
-    reset_env(&b, &snake);
-    run_simulation(&b, &snake, verbose, iter);
+  FILE* episode_log = NULL;
+  if(log_path != NULL) {
+    episode_log = fopen(log_path, "ab");
+    if(episode_log == NULL) {
+      exit_program("Could not open episode log %s", log_path);
+    }
   }
 
-  free_model(model);
-  free(model);
-  free_snake(&snake, b.size_y);
-  free_board(&b);
-}
+  if(strcmp(mode, "plan") == 0) {
+    run_planner(n_iters, episode_log, verbose);
+    free_trainer(&trainer);
+    close_log(episode_log);
+    return 0;
+  }
 
-int main() {
-  srand(time(NULL));
+  if(strcmp(mode, "train") == 0) {
+    trainer.episode_log = episode_log;
+    trainer.render = render_training;
+    train(&trainer, n_iters, verbose);
+    free_trainer(&trainer);
+    close_log(episode_log);
+    if(trainer.telemetry.out != NULL) fclose(trainer.telemetry.out);
+    return 0;
+  }
 
+  // exit_program leaves through exit, so restore the terminal from there
   set_input_mode(1);
+  atexit(restore_input_mode);
 
-  /*Matrix *S = alloc_matrix(64, 1);
-  rand_matrix(S, 0.0, 1.0);
-  Model* model = malloc(sizeof(Model));
-  init_model(model, 48);
-
-  Matrix *out = alloc_matrix(4, 1);
-  out = forward(model, S);
-
-  free_model(model);
-  free_matrix(S);
-  free(model);*/
+  main_loop(episode_log);
 
-  main_loop();
-
-  /*
-  train(2000, 0);
-  exploration = 0.0;
-  train(5, 1);
-  */
-
-  set_input_mode(0);
+  free_trainer(&trainer);
+  close_log(episode_log);
   return 0;
 }
@@ -0,0 +1,631 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "nn.h"
+#include "util.h"
+
+Matrix* alloc_matrix(int n, int m) {
+  Matrix* mat_struct = malloc(sizeof(Matrix));
+  if (!mat_struct) return NULL;
+
+  mat_struct->rows = n;
+  mat_struct->cols = m;
+
+  mat_struct->mat = malloc(n * sizeof(float*));
+  if (!mat_struct->mat) {
+      free(mat_struct);
+      return NULL;
+  }
+  for(int i = 0; i < n; i++) {
+    mat_struct->mat[i] = malloc(m * sizeof(float));
+    if (!mat_struct->mat[i]) {
+      for (int j = 0; j < i; j++) {
+        free(mat_struct->mat[j]);
+      }
+      free(mat_struct->mat);
+      free(mat_struct);
+      return NULL;
+    }
+  }
+  return mat_struct;
+}
+
+void free_matrix(Matrix* A) {
+  for(int i = 0; i < A->rows; i++) {
+    free(A->mat[i]); 
+  }
+  free(A->mat);
+}
+
+void rand_matrix(Matrix* A, float a, float b, uint32_t* rng) {
+  for(int i = 0; i < A->rows; i++) {
+    for(int j = 0; j < A->cols; j++) {
+      A->mat[i][j] = rand_float(rng, a, b);
+    }
+  }
+}
+
+void matmul(Matrix* A, Matrix* B, Matrix* C) {
+  if(A->cols != B->rows || C->rows != A->rows || C->cols != B->cols) {
+    exit_program(
+      "Tried to multiply matricies with sizes %dx%d, %dx%d to get matrix %dx%d",
+      A->rows, A->cols, B->rows, B->cols, C->rows, C->cols);
+  }
+
+  for(int i = 0; i < C->rows; i++) {
+    for(int j = 0; j < C->cols; j++) {
+      for(int k = 0; k < A->cols; k++) {
+        C->mat[i][j] += A->mat[i][k] * B->mat[k][j];
+      }
+    }
+  }
+}
+
+void print_matrix(Matrix* A) {
+  printf("%d x %d\n", A->rows, A->cols);
+  for(int i = 0; i < A->rows; i++) {
+    for(int j = 0; j < A->cols; j++) {
+      printf("%f  ", A->mat[i][j]);
+    }
+    printf("\n");
+  }
+}
+
+/* Element-wise adds elements from B to A
+ */
+void elem_add(Matrix* A, Matrix* B) {
+  if(A->cols != B->cols || A->rows != B->rows ) {
+    exit_program(
+      "Tried to add matricies with sizes %dx%d, %dx%d to each other",
+      A->rows, A->cols, B->rows, B->cols);
+  }
+  for(int i = 0; i < A->rows; i++) {
+    for(int j = 0; j < A->cols; j++) {
+      A->mat[i][j] += B->mat[i][j];
+    }
+  }
+}
+
+void copy_matrix(Matrix* A, Matrix* B) {
+  if(A->cols != B->cols || A->rows != B->rows ) {
+    exit_program(
+      "Tried to copy matrix with size %dx%d to %dx%d",
+      A->rows, A->cols, B->rows, B->cols);
+  }
+  for(int i = 0; i < A->rows; i++) {
+    for(int j = 0; j < A->cols; j++) {
+      B->mat[i][j] = A->mat[i][j];
+    }
+  }
+}
+
+void ReLU(Matrix* A) {
+  for(int i = 0; i < A->rows; i++) {
+    for(int j = 0; j < A->cols; j++) {
+      A->mat[i][j] = A->mat[i][j] > 0 ? A->mat[i][j] : 0;
+    }
+  }
+}
+
+void zero_matrix(Matrix* A) {
+  for(int i = 0; i < A->rows; i++) {
+    for(int j = 0; j < A->cols; j++) {
+      A->mat[i][j] = 0.0f;
+    }
+  }
+}
+
+/* C += A^T * B
+ */
+void matmul_at(Matrix* A, Matrix* B, Matrix* C) {
+  if(A->rows != B->rows || C->rows != A->cols || C->cols != B->cols) {
+    exit_program(
+      "Tried to multiply transposed %dx%d by %dx%d to get matrix %dx%d",
+      A->rows, A->cols, B->rows, B->cols, C->rows, C->cols);
+  }
+
+  for(int k = 0; k < A->rows; k++) {
+    for(int i = 0; i < C->rows; i++) {
+      float a = A->mat[k][i];
+      for(int j = 0; j < C->cols; j++) {
+        C->mat[i][j] += a * B->mat[k][j];
+      }
+    }
+  }
+}
+
+/* C += A * B^T
+ */
+void matmul_bt(Matrix* A, Matrix* B, Matrix* C) {
+  if(A->cols != B->cols || C->rows != A->rows || C->cols != B->rows) {
+    exit_program(
+      "Tried to multiply %dx%d by transposed %dx%d to get matrix %dx%d",
+      A->rows, A->cols, B->rows, B->cols, C->rows, C->cols);
+  }
+
+  for(int i = 0; i < C->rows; i++) {
+    for(int j = 0; j < C->cols; j++) {
+      float sum = 0.0f;
+      for(int k = 0; k < A->cols; k++) {
+        sum += A->mat[i][k] * B->mat[j][k];
+      }
+      C->mat[i][j] += sum;
+    }
+  }
+}
+
+/* A += alpha * B
+ */
+void scale_add(Matrix* A, Matrix* B, float alpha) {
+  if(A->cols != B->cols || A->rows != B->rows ) {
+    exit_program(
+      "Tried to add matricies with sizes %dx%d, %dx%d to each other",
+      A->rows, A->cols, B->rows, B->cols);
+  }
+  for(int i = 0; i < A->rows; i++) {
+    for(int j = 0; j < A->cols; j++) {
+      A->mat[i][j] += alpha * B->mat[i][j];
+    }
+  }
+}
+
+void release_matrix(Matrix* A) {
+  if(A == NULL) return;
+  free_matrix(A);
+  free(A);
+}
+
+/* Layers are appended with add_* after init_model, e.g.
+ *   init_model(m, 10, 10);
+ *   add_flatten(m); add_dense(m, 48, &rng); add_relu(m); add_dense(m, 4, &rng);
+ */
+void init_model(Model* m, int in_rows, int in_cols) {
+  m->layers = NULL;
+  m->n_layers = 0;
+  m->in_rows = in_rows;
+  m->in_cols = in_cols;
+  m->x = NULL;
+  m->grad = NULL;
+}
+
+void output_shape(Model* m, int* rows, int* cols) {
+  if(m->n_layers == 0) {
+    *rows = m->in_rows;
+    *cols = m->in_cols;
+  } else {
+    *rows = m->layers[m->n_layers - 1].out->rows;
+    *cols = m->layers[m->n_layers - 1].out->cols;
+  }
+}
+
+static Layer* push_layer(Model* m, LayerType type) {
+  Layer* layers = realloc(m->layers, (m->n_layers + 1) * sizeof(Layer));
+  if(layers == NULL) {
+    exit_program("Malloc error");
+  }
+  m->layers = layers;
+
+  Layer* l = &m->layers[m->n_layers++];
+  l->type = type;
+  l->W = NULL;
+  l->b = NULL;
+  l->dW = NULL;
+  l->out = NULL;
+  l->delta = NULL;
+  l->cols = NULL;
+  return l;
+}
+
+void add_flatten(Model* m) {
+  int rows, cols;
+  output_shape(m, &rows, &cols);
+  Layer* l = push_layer(m, FlattenLayer);
+  l->out = alloc_matrix(rows * cols, 1);
+  l->delta = alloc_matrix(rows, cols);
+}
+
+void add_dense(Model* m, int width, uint32_t* rng) {
+  int rows, cols;
+  output_shape(m, &rows, &cols);
+  if(cols != 1) {
+    exit_program("Dense layer needs a column vector input, got %dx%d",
+                 rows, cols);
+  }
+  Layer* l = push_layer(m, DenseLayer);
+  l->W = alloc_matrix(width, rows);
+  l->b = alloc_matrix(width, 1);
+  l->dW = alloc_matrix(width, rows);
+  l->out = alloc_matrix(width, 1);
+  l->delta = alloc_matrix(rows, 1);
+
+  // keep activations in range no matter how deep the network gets
+  float r = 1.0f / sqrtf((float)rows);
+  rand_matrix(l->W, -r, r, rng);
+  rand_matrix(l->b, -r, r, rng);
+}
+
+void add_relu(Model* m) {
+  int rows, cols;
+  output_shape(m, &rows, &cols);
+  Layer* l = push_layer(m, ReLULayer);
+  l->out = alloc_matrix(rows, cols);
+  l->delta = alloc_matrix(rows, cols);
+}
+
+/* 3x3 convolution with zero padding over the whole input grid, so the
+ * output keeps the grid size. Feature maps are stored as channels x (H*W);
+ * the model input itself (H x W) is read as a single channel.
+ */
+void add_conv(Model* m, int channels, uint32_t* rng) {
+  int rows, cols;
+  output_shape(m, &rows, &cols);
+  for(int i = 0; i < m->n_layers; i++) {
+    if(m->layers[i].type != ConvLayer && m->layers[i].type != ReLULayer) {
+      exit_program("Conv layer has to operate on the input grid");
+    }
+  }
+  int area = m->in_rows * m->in_cols;
+  int in_channels = rows * cols / area;
+  int patch = in_channels * KERNEL_SIZE * KERNEL_SIZE;
+
+  Layer* l = push_layer(m, ConvLayer);
+  l->W = alloc_matrix(channels, patch);
+  l->b = alloc_matrix(channels, 1);
+  l->dW = alloc_matrix(channels, patch);
+  l->cols = alloc_matrix(patch, area);
+  l->out = alloc_matrix(channels, area);
+  l->delta = alloc_matrix(rows, cols);
+
+  float r = 1.0f / sqrtf((float)patch);
+  rand_matrix(l->W, -r, r, rng);
+  rand_matrix(l->b, -r, r, rng);
+}
+
+/* Global average pooling: channels x (H*W) -> channels x 1. Together with
+ * conv layers this keeps the weight count independent of the grid size.
+ */
+void add_pool(Model* m) {
+  int rows, cols;
+  output_shape(m, &rows, &cols);
+  Layer* l = push_layer(m, PoolLayer);
+  l->out = alloc_matrix(rows, 1);
+  l->delta = alloc_matrix(rows, cols);
+}
+
+/* Standard Q-network: flatten, then dense + ReLU for every hidden width and
+ * a final dense layer with one output per move.
+ */
+void init_mlp(Model* m, int in_rows, int in_cols, int* hidden, int depth,
+              uint32_t* rng) {
+  init_model(m, in_rows, in_cols);
+  add_flatten(m);
+  for(int i = 0; i < depth; i++) {
+    add_dense(m, hidden[i], rng);
+    add_relu(m);
+  }
+  add_dense(m, 4, rng);
+}
+
+/* Convolutional Q-network: conv + ReLU for every channel count, global
+ * pooling and a final dense layer with one output per move.
+ */
+void init_cnn(Model* m, int in_rows, int in_cols, int* channels, int depth,
+              uint32_t* rng) {
+  init_model(m, in_rows, in_cols);
+  for(int i = 0; i < depth; i++) {
+    add_conv(m, channels[i], rng);
+    add_relu(m);
+  }
+  add_pool(m);
+  add_dense(m, 4, rng);
+}
+
+void free_model(Model* m) {
+  for(int i = 0; i < m->n_layers; i++) {
+    release_matrix(m->layers[i].W);
+    release_matrix(m->layers[i].b);
+    release_matrix(m->layers[i].dW);
+    release_matrix(m->layers[i].out);
+    release_matrix(m->layers[i].delta);
+    release_matrix(m->layers[i].cols);
+  }
+  free(m->layers);
+  release_matrix(m->grad);
+  m->layers = NULL;
+  m->grad = NULL;
+  m->n_layers = 0;
+}
+
+void flatten(Matrix* A, Matrix* x) {
+  for(int i = 0; i < A->rows; i++) {
+    for(int j = 0; j < A->cols; j++) {
+      x->mat[i * A->cols + j][0] = A->mat[i][j];
+    }
+  }
+}
+
+void unflatten(Matrix* x, Matrix* A) {
+  for(int i = 0; i < A->rows; i++) {
+    for(int j = 0; j < A->cols; j++) {
+      A->mat[i][j] = x->mat[i * A->cols + j][0];
+    }
+  }
+}
+
+/* Unrolls every 3x3 patch of a channels x h x w feature map into a column
+ * of cols, so the convolution becomes a single matmul. `in` may be laid
+ * out either as h x w (one channel) or channels x (h*w).
+ */
+void im2col(Matrix* in, Matrix* cols, int h, int w) {
+  int half = KERNEL_SIZE / 2;
+  for(int row = 0; row < cols->rows; row++) {
+    int c = row / (KERNEL_SIZE * KERNEL_SIZE);
+    int ky = row / KERNEL_SIZE % KERNEL_SIZE - half;
+    int kx = row % KERNEL_SIZE - half;
+    for(int y = 0; y < h; y++) {
+      for(int x = 0; x < w; x++) {
+        int sy = y + ky;
+        int sx = x + kx;
+        float v = 0.0f;
+        if(sy >= 0 && sy < h && sx >= 0 && sx < w) {
+          int idx = (c * h + sy) * w + sx;
+          v = in->mat[idx / in->cols][idx % in->cols];
+        }
+        cols->mat[row][y * w + x] = v;
+      }
+    }
+  }
+}
+
+/* Inverse of im2col: sums every column entry back into its source pixel.
+ */
+void col2im(Matrix* cols, Matrix* out, int h, int w) {
+  int half = KERNEL_SIZE / 2;
+  zero_matrix(out);
+  for(int row = 0; row < cols->rows; row++) {
+    int c = row / (KERNEL_SIZE * KERNEL_SIZE);
+    int ky = row / KERNEL_SIZE % KERNEL_SIZE - half;
+    int kx = row % KERNEL_SIZE - half;
+    for(int y = 0; y < h; y++) {
+      for(int x = 0; x < w; x++) {
+        int sy = y + ky;
+        int sx = x + kx;
+        if(sy >= 0 && sy < h && sx >= 0 && sx < w) {
+          int idx = (c * h + sy) * w + sx;
+          out->mat[idx / out->cols][idx % out->cols] += cols->mat[row][y * w + x];
+        }
+      }
+    }
+  }
+}
+
+/* For every column j of Q picks the row with the largest value, never
+ * picking row skip[j] (-1 to allow all rows). Ties and NaNs go to the
+ * lowest row. With SSE2 four columns are handled at once.
+ */
+void argmax_cols(Matrix* Q, const int* skip, int* out) {
+  int j = 0;
+#ifdef __SSE2__
+  __m128i zero = _mm_setzero_si128();
+  __m128i one = _mm_set1_epi32(1);
+  for(; j + 4 <= Q->cols; j += 4) {
+    __m128i s = _mm_loadu_si128((const __m128i*)(skip + j));
+    // start from row 0, or row 1 where row 0 is skipped
+    __m128i idx = _mm_and_si128(_mm_cmpeq_epi32(s, zero), one);
+    __m128 best = _mm_set1_ps(-INFINITY);
+    for(int r = 0; r < Q->rows; r++) {
+      __m128i row = _mm_set1_epi32(r);
+      __m128 v = _mm_loadu_ps(Q->mat[r] + j);
+      __m128 gt = _mm_andnot_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(s, row)),
+                                _mm_cmpgt_ps(v, best));
+      __m128i gti = _mm_castps_si128(gt);
+      best = _mm_or_ps(_mm_and_ps(gt, v), _mm_andnot_ps(gt, best));
+      idx = _mm_or_si128(_mm_and_si128(gti, row), _mm_andnot_si128(gti, idx));
+    }
+    _mm_storeu_si128((__m128i*)(out + j), idx);
+  }
+#endif
+  for(; j < Q->cols; j++) {
+    int best_id = skip[j] == 0 ? 1 : 0;
+    float best = -INFINITY;
+    for(int r = 0; r < Q->rows; r++) {
+      if(r != skip[j] && Q->mat[r][j] > best) {
+        best = Q->mat[r][j];
+        best_id = r;
+      }
+    }
+    out[j] = best_id;
+  }
+}
+
+/* Returns the output buffer of the last layer. It belongs to the model and
+ * is overwritten by the next call.
+ */
+Matrix* forward(Model* m, Matrix* X) {
+  if(X->rows != m->in_rows || X->cols != m->in_cols) {
+    exit_program("Model expects %dx%d input, got %dx%d",
+                 m->in_rows, m->in_cols, X->rows, X->cols);
+  }
+  m->x = X;
+
+  Matrix* in = X;
+  for(int i = 0; i < m->n_layers; i++) {
+    Layer* l = &m->layers[i];
+    switch(l->type) {
+      case DenseLayer:
+        copy_matrix(l->b, l->out);
+        matmul(l->W, in, l->out);
+        break;
+      case ReLULayer:
+        copy_matrix(in, l->out);
+        ReLU(l->out);
+        break;
+      case FlattenLayer:
+        flatten(in, l->out);
+        break;
+      case ConvLayer:
+        im2col(in, l->cols, m->in_rows, m->in_cols);
+        for(int c = 0; c < l->out->rows; c++) {
+          for(int j = 0; j < l->out->cols; j++) {
+            l->out->mat[c][j] = l->b->mat[c][0];
+          }
+        }
+        matmul(l->W, l->cols, l->out);
+        break;
+      case PoolLayer:
+        for(int c = 0; c < in->rows; c++) {
+          float sum = 0.0f;
+          for(int j = 0; j < in->cols; j++) {
+            sum += in->mat[c][j];
+          }
+          l->out->mat[c][0] = sum / in->cols;
+        }
+        break;
+    }
+    in = l->out;
+  }
+  return in;
+}
+
+/* Propagates dL/d(output) back through the activations of the last forward
+ * pass and applies a gradient descent step to every layer.
+ */
+void backprop(Model* m, Matrix* grad, float lr) {
+  for(int i = m->n_layers - 1; i >= 0; i--) {
+    Layer* l = &m->layers[i];
+    Matrix* in = i == 0 ? m->x : m->layers[i - 1].out;
+    switch(l->type) {
+      case DenseLayer:
+        // nobody consumes the gradient w.r.t. the network input
+        if(i > 0) {
+          zero_matrix(l->delta);
+          matmul_at(l->W, grad, l->delta);
+        }
+        zero_matrix(l->dW);
+        matmul_bt(grad, in, l->dW);
+        scale_add(l->W, l->dW, -lr);
+        scale_add(l->b, grad, -lr);
+        break;
+      case ReLULayer:
+        for(int r = 0; r < in->rows; r++) {
+          for(int c = 0; c < in->cols; c++) {
+            l->delta->mat[r][c] = in->mat[r][c] > 0.0f ? grad->mat[r][c] : 0.0f;
+          }
+        }
+        break;
+      case FlattenLayer:
+        unflatten(grad, l->delta);
+        break;
+      case ConvLayer:
+        zero_matrix(l->dW);
+        matmul_bt(grad, l->cols, l->dW);
+        // the im2col buffer is done, reuse it for the input gradient
+        if(i > 0) {
+          zero_matrix(l->cols);
+          matmul_at(l->W, grad, l->cols);
+          col2im(l->cols, l->delta, m->in_rows, m->in_cols);
+        }
+        scale_add(l->W, l->dW, -lr);
+        for(int c = 0; c < grad->rows; c++) {
+          float sum = 0.0f;
+          for(int j = 0; j < grad->cols; j++) {
+            sum += grad->mat[c][j];
+          }
+          l->b->mat[c][0] -= lr * sum;
+        }
+        break;
+      case PoolLayer:
+        for(int c = 0; c < in->rows; c++) {
+          for(int j = 0; j < in->cols; j++) {
+            l->delta->mat[c][j] = grad->mat[c][0] / in->cols;
+          }
+        }
+        break;
+    }
+    grad = l->delta;
+  }
+}
+
+#define MODEL_MAGIC 0x4e4e5343u  // "CSNN"
+
+/* Returns 0 if any write failed.
+ */
+static int write_params(FILE* f, Matrix* A) {
+  if(A == NULL) return 1;
+  if(fwrite(&A->rows, sizeof(int), 1, f) != 1 ||
+     fwrite(&A->cols, sizeof(int), 1, f) != 1) {
+    return 0;
+  }
+  for(int i = 0; i < A->rows; i++) {
+    if(fwrite(A->mat[i], sizeof(float), A->cols, f) != (size_t)A->cols) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static int read_params(FILE* f, Matrix* A) {
+  if(A == NULL) return 1;
+  int rows, cols;
+  if(fread(&rows, sizeof(int), 1, f) != 1 ||
+     fread(&cols, sizeof(int), 1, f) != 1 ||
+     rows != A->rows || cols != A->cols) {
+    return 0;
+  }
+  for(int i = 0; i < A->rows; i++) {
+    if(fread(A->mat[i], sizeof(float), A->cols, f) != (size_t)A->cols) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* Checkpoint format: magic, layer count, then per layer its type followed
+ * by the shapes and values of W and b if it has them.
+ */
+void save_model(Model* m, const char* path) {
+  FILE* f = fopen(path, "wb");
+  if(f == NULL) {
+    exit_program("Could not open checkpoint %s", path);
+  }
+  uint32_t magic = MODEL_MAGIC;
+  int ok = fwrite(&magic, sizeof(magic), 1, f) == 1 &&
+           fwrite(&m->n_layers, sizeof(int), 1, f) == 1;
+  for(int i = 0; ok && i < m->n_layers; i++) {
+    int type = m->layers[i].type;
+    ok = fwrite(&type, sizeof(int), 1, f) == 1 &&
+         write_params(f, m->layers[i].W) && write_params(f, m->layers[i].b);
+  }
+  if(fclose(f) != 0 || !ok) {
+    exit_program("Could not write checkpoint %s", path);
+  }
+}
+
+/* Loads weights into a model built with the same layers as the one that
+ * was saved.
+ */
+void load_model(Model* m, const char* path) {
+  FILE* f = fopen(path, "rb");
+  if(f == NULL) {
+    exit_program("Could not open checkpoint %s", path);
+  }
+  uint32_t magic;
+  int n_layers;
+  if(fread(&magic, sizeof(magic), 1, f) != 1 || magic != MODEL_MAGIC ||
+     fread(&n_layers, sizeof(int), 1, f) != 1 || n_layers != m->n_layers) {
+    exit_program("Checkpoint %s does not match the model", path);
+  }
+  for(int i = 0; i < m->n_layers; i++) {
+    int type;
+    if(fread(&type, sizeof(int), 1, f) != 1 || type != (int)m->layers[i].type ||
+       !read_params(f, m->layers[i].W) || !read_params(f, m->layers[i].b)) {
+      exit_program("Checkpoint %s does not match the model", path);
+    }
+  }
+  fclose(f);
+}
@@ -0,0 +1,89 @@
+#ifndef NN_H
+#define NN_H
+
+#include <stdint.h>
+
+/* Matrix kernels and a layer-list network. A Model owns all of its
+ * buffers and weights are drawn from a caller-owned xorshift32 state, so
+ * independent models can be trained side by side.
+ */
+
+typedef struct {
+  float** mat;
+  int rows;
+  int cols;
+} Matrix;
+
+Matrix* alloc_matrix(int n, int m);
+void free_matrix(Matrix* A);
+void release_matrix(Matrix* A);
+void rand_matrix(Matrix* A, float a, float b, uint32_t* rng);
+void zero_matrix(Matrix* A);
+void copy_matrix(Matrix* A, Matrix* B);
+void print_matrix(Matrix* A);
+
+void matmul(Matrix* A, Matrix* B, Matrix* C);
+void matmul_at(Matrix* A, Matrix* B, Matrix* C);
+void matmul_bt(Matrix* A, Matrix* B, Matrix* C);
+void elem_add(Matrix* A, Matrix* B);
+void scale_add(Matrix* A, Matrix* B, float alpha);
+void ReLU(Matrix* A);
+
+void flatten(Matrix* A, Matrix* x);
+void unflatten(Matrix* x, Matrix* A);
+void im2col(Matrix* in, Matrix* cols, int h, int w);
+void col2im(Matrix* cols, Matrix* out, int h, int w);
+void argmax_cols(Matrix* Q, const int* skip, int* out);
+
+#define KERNEL_SIZE 3
+
+typedef enum {
+  DenseLayer,
+  ReLULayer,
+  FlattenLayer,
+  ConvLayer,
+  PoolLayer,
+} LayerType;
+
+/* Every layer owns the buffers it writes during forward and backward, so
+ * a training step does not allocate anything.
+ */
+typedef struct {
+  LayerType type;
+  Matrix* W;      // dense / conv weights
+  Matrix* b;      // dense / conv bias
+  Matrix* dW;     // weight gradient scratch
+  Matrix* cols;   // conv im2col buffer
+  Matrix* out;    // activations of the last forward pass
+  Matrix* delta;  // dL/d(input) of the last backward pass
+} Layer;
+
+typedef struct {
+  Layer* layers;
+  int n_layers;
+  int in_rows;
+  int in_cols;
+  Matrix* x;      // input of the last forward pass, not owned
+  Matrix* grad;   // dL/d(output) scratch
+} Model;
+
+void init_model(Model* m, int in_rows, int in_cols);
+void add_flatten(Model* m);
+void add_dense(Model* m, int width, uint32_t* rng);
+void add_relu(Model* m);
+void add_conv(Model* m, int channels, uint32_t* rng);
+void add_pool(Model* m);
+void init_mlp(Model* m, int in_rows, int in_cols, int* hidden, int depth,
+              uint32_t* rng);
+void init_cnn(Model* m, int in_rows, int in_cols, int* channels, int depth,
+              uint32_t* rng);
+void output_shape(Model* m, int* rows, int* cols);
+void free_model(Model* m);
+
+Matrix* forward(Model* m, Matrix* X);
+void backprop(Model* m, Matrix* grad, float lr);
+
+void save_model(Model* m, const char* path);
+void load_model(Model* m, const char* path);
+
+#endif
@@ -0,0 +1,84 @@
+#include <stdlib.h>
+#include <math.h>
+
+#include "planner.h"
+#include "util.h"
+
+void init_planner(Planner* p, Board* b, uint32_t seed) {
+  p->rollouts = 200;
+  p->depth = 30;
+  p->gamma = 0.95;
+  p->food_prob = 40;
+  p->rng = seed | 1;
+  p->sim_steps = 0;
+  init_snapshot(&p->root, b);
+}
+
+void free_planner(Planner* p) {
+  free_snapshot(&p->root);
+}
+
+/* Whether moving one field in direction d keeps the snake alive.
+ */
+static int is_safe(Board* b, SnakeData* s, Dir d) {
+  Point p = s->start;
+  switch(d) {
+    case UP: p.y--; break;
+    case DOWN: p.y++; break;
+    case LEFT: p.x--; break;
+    case RIGHT: p.x++; break;
+    default: return 0;
+  }
+  BoardField f = b->map[p.y][p.x];
+  return f == Empty || f == Food;
+}
+
+/* Random playout policy: any turn or straight move that does not kill the
+ * snake right away, or any legal move if there is none.
+ */
+static Dir rollout_move(Planner* p, Board* b, SnakeData* s) {
+  Dir safe[3];
+  int n = 0;
+  for(int d = UP; d <= RIGHT; d++) {
+    if((Dir)d != reverse_dir(s->direction) && is_safe(b, s, d)) {
+      safe[n++] = d;
+    }
+  }
+  if(n == 0) return s->direction;
+  return safe[xorshift32(&p->rng) % n];
+}
+
+static float rollout(Planner* p, Board* b, SnakeData* s, Dir first) {
+  float ret = 0.0f;
+  float discount = 1.0f;
+  s->direction = first;
+  for(int step = 0; step < p->depth; step++) {
+    ret += discount * update_snake(s, b);
+    p->sim_steps++;
+    if(s->dead) break;
+    generate_food(b, p->food_prob);
+    discount *= p->gamma;
+    s->direction = rollout_move(p, b, s);
+  }
+  return ret;
+}
+
+Dir plan_move(Planner* p, Board* b, SnakeData* s) {
+  save_state(&p->root, b, s);
+
+  Dir best = s->direction;
+  float best_score = -INFINITY;
+  for(int d = UP; d <= RIGHT; d++) {
+    if((Dir)d == reverse_dir(s->direction)) continue;
+    float total = 0.0f;
+    for(int r = 0; r < p->rollouts; r++) {
+      total += rollout(p, b, s, d);
+      restore_state(&p->root, b, s);
+    }
+    if(total / p->rollouts > best_score) {
+      best_score = total / p->rollouts;
+      best = d;
+    }
+  }
+  return best;
+}
@@ -0,0 +1,26 @@
+#ifndef PLANNER_H
+#define PLANNER_H
+
+#include <stdint.h>
+
+#include "snake.h"
+
+/* Monte-Carlo planner: every legal move is scored by the mean discounted
+ * reward of `rollouts` random playouts of up to `depth` steps, all run on
+ * the real engine from a snapshot of the current game.
+ */
+typedef struct {
+  int rollouts;
+  int depth;
+  float gamma;
+  int food_prob;
+  uint32_t rng;
+  long sim_steps;     // engine steps simulated so far
+  Snapshot root;
+} Planner;
+
+void init_planner(Planner* p, Board* b, uint32_t seed);
+void free_planner(Planner* p);
+Dir plan_move(Planner* p, Board* b, SnakeData* s);
+
+#endif
@@ -0,0 +1,326 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "snake.h"
+#include "util.h"
+
+/* xorshift32. The engine draws only from its own stream, so an episode is
+ * fully determined by its seed and moves.
+ */
+uint32_t board_rand(Board* b) {
+  return xorshift32(&b->rng);
+}
+
+void seed_board(Board* b, uint32_t seed) {
+  b->rng = seed ? seed : 1;
+}
+
+void generate_food(Board*b, int prob) {
+  int make_food = board_rand(b) % 100;
+  if(make_food > prob && b->food <= MAX_FOOD) {
+    int new_x = board_rand(b) % b->size_x;
+    int new_y = board_rand(b) % b->size_y;
+    // dropping food onto food would count it twice
+    if(b->map[new_y][new_x] == Snake || b->map[new_y][new_x] == Food ||
+       new_y == 0 || new_x == 0 ||
+       new_y == b->size_y-1 || new_x == b->size_x-1) return;
+    b->map[new_y][new_x] = Food;
+    b->food++;
+  }
+}
+
+void reset_board(Board* b) {
+  b->food = 0;
+  for(int i = 0; i < b->size_y; i++) {
+    for(int j = 0; j < b->size_x; j++) {
+      if(i == 0 || j == 0 || j == b->size_x - 1 || i == b->size_y - 1) {
+        b->map[i][j] = Border;
+      }
+      else {
+        b->map[i][j] = Empty;
+      }
+    }
+  }
+}
+
+void init_empty_board(Board* b, int size_x, int size_y) {
+  b->food = 0;
+  b->size_y = size_y;
+  b->size_x = size_x;
+  // callers pick the engine stream with seed_board or start_episode
+  seed_board(b, 1);
+
+  b->map = malloc(size_y * sizeof(BoardField*));
+  if (b->map == NULL) {
+    exit_program("Malloc error");
+  }
+
+  // rows share one block so the whole grid can be copied with one memcpy
+  BoardField* cells = malloc(size_y * size_x * sizeof(BoardField));
+  if (cells == NULL) {
+    free(b->map);
+    exit_program("Malloc error");
+  }
+  for(int i = 0; i < size_y; i++) {
+    b->map[i] = cells + i * size_x;
+  }
+  reset_board(b);  
+}
+
+void free_board(Board* b) {
+  if(b->map != NULL) {
+    free(b->map[0]);
+    free(b->map);
+  }
+}
+
+void reset_snake(SnakeData* snake, Board* b) {
+  snake->start = (Point){.x = 3, .y = 2};
+  snake->end = (Point){.x = 2, .y = 2};
+  snake->direction = RIGHT;
+  snake->tummy = 0;
+  snake->animation = 0;
+  snake->dead = 0;
+  snake->ate = 0;
+
+  for(int i = 0; i < b->size_y; i++) {
+    for(int j = 0; j < b->size_x; j++) {
+      snake->dirMap[i][j] = NIL;
+    }
+  }
+
+  Point snake_body = snake->end;
+  while(snake_body.x != snake->start.x || snake_body.y != snake->start.y) {
+    snake->dirMap[snake_body.y][snake_body.x] = snake->direction;  
+    b->map[snake_body.y][snake_body.x] = Snake;  
+    switch(snake->direction) {
+      case RIGHT:
+        snake_body.x++;
+        break;
+      default:
+        exit_program("Unsupported spawn direction %d", snake->direction);
+    }
+  }
+
+  b->map[snake_body.y][snake_body.x] = Snake;
+  snake->dirMap[snake_body.y][snake_body.x] = snake->direction; 
+}
+
+void init_snake(SnakeData* snake, Board* b) {
+
+  snake->dirMap = malloc(b->size_y * sizeof(Dir*));
+  if(snake->dirMap == NULL) {
+    exit_program("Malloc error");
+  }
+  
+  Dir* dirs = malloc(b->size_y * b->size_x * sizeof(Dir));
+  if (dirs == NULL) {
+    free(snake->dirMap);
+    exit_program("Malloc error");
+  }
+  for(int i = 0; i < b->size_y; i++) {
+    snake->dirMap[i] = dirs + i * b->size_x;
+  }
+ 
+  reset_snake(snake, b);
+}
+
+void free_snake(SnakeData* s, int board_size_y) {
+  (void)board_size_y;
+  if(s->dirMap != NULL) {
+    free(s->dirMap[0]);
+    free(s->dirMap);
+  }
+}
+
+void init_snapshot(Snapshot* snap, Board* b) {
+  snap->n_cells = b->size_x * b->size_y;
+  snap->cells = malloc(snap->n_cells * sizeof(BoardField));
+  snap->dirs = malloc(snap->n_cells * sizeof(Dir));
+  if(snap->cells == NULL || snap->dirs == NULL) {
+    exit_program("Malloc error");
+  }
+}
+
+void free_snapshot(Snapshot* snap) {
+  free(snap->cells);
+  free(snap->dirs);
+  snap->cells = NULL;
+  snap->dirs = NULL;
+}
+
+void save_state(Snapshot* snap, Board* b, SnakeData* s) {
+  snap->board = *b;
+  snap->snake = *s;
+  memcpy(snap->cells, b->map[0], snap->n_cells * sizeof(BoardField));
+  memcpy(snap->dirs, s->dirMap[0], snap->n_cells * sizeof(Dir));
+}
+
+void restore_state(Snapshot* snap, Board* b, SnakeData* s) {
+  BoardField** map = b->map;
+  Dir** dirMap = s->dirMap;
+  *b = snap->board;
+  *s = snap->snake;
+  b->map = map;
+  s->dirMap = dirMap;
+  memcpy(b->map[0], snap->cells, snap->n_cells * sizeof(BoardField));
+  memcpy(s->dirMap[0], snap->dirs, snap->n_cells * sizeof(Dir));
+}
+
+int update_snake(SnakeData* s, Board* b) {
+  s->animation = s->animation == 0 ? 1 : 0;
+  s->ate = 0;
+  // change the direction at the turn
+  s->dirMap[s->start.y][s->start.x] = s->direction; 
+  // snake head
+  switch(s->direction) {
+    case RIGHT:
+      s->start.x++;
+      break;
+    case LEFT:
+      s->start.x--;
+      break;
+    case DOWN:
+      s->start.y++;
+      break;
+    case UP:
+      s->start.y--;
+      break;
+    default:
+      exit_program("Unsupported snake direction %d", s->direction);
+  }
+  if(s->start.x >= b->size_x || s->start.x < 0 || 
+     s->start.y >= b->size_y || s->start.y < 0) {
+    // we went out of bounds
+    exit_program("snake went out of bounds");
+  }
+  s->dirMap[s->start.y][s->start.x] = s->direction; 
+  if(b->map[s->start.y][s->start.x] == Snake ||
+      b->map[s->start.y][s->start.x] == Border) {
+    //exit_program("snake eating itself!");
+    s->dead = 1;
+    return -500;
+  }
+  int ate = 0;
+  if(b->map[s->start.y][s->start.x] == Food) {
+    ate = 1;
+    s->ate = 1;
+    s->tummy++;
+    b->food--;
+  }
+  b->map[s->start.y][s->start.x] = Snake;
+
+  // if we ate food we make our snake longer by not reducing tail this frame
+  if(ate) return 100;
+  // snake butt
+  Point old_end = s->end;
+  b->map[s->end.y][s->end.x] = Empty;
+  switch(s->dirMap[s->end.y][s->end.x]) {
+    case RIGHT:
+      s->end.x++;
+      break;
+    case LEFT:
+      s->end.x--;
+      break;
+    case DOWN:
+      s->end.y++;
+      break;
+    case UP:
+      s->end.y--;
+      break;
+    case NIL:
+      break;
+    default:
+      exit_program("Corrupt tail direction %d", s->dirMap[s->end.y][s->end.x]);
+  }
+  s->dirMap[old_end.y][old_end.x] = NIL;
+  return -1;
+}
+
+void set_snake_direction(char c, SnakeData* s) {
+  switch(c) {
+    case 'd':
+      if(s->direction != LEFT)
+        s->direction = RIGHT;
+      break;
+    case 'a':
+      if(s->direction != RIGHT)
+        s->direction = LEFT;
+      break;
+    case 'w':
+      if(s->direction != DOWN)
+        s->direction = UP;
+      break;
+    case 's':
+      if(s->direction != UP)
+        s->direction = DOWN;
+      break;
+    default:
+      exit_program("Unsupported direction key %c", c);
+  }
+}
+
+Dir reverse_dir(Dir d) {
+  switch(d) {
+    case UP: return DOWN;
+    case DOWN: return UP;
+    case LEFT: return RIGHT;
+    case RIGHT: return LEFT;
+    default: return NIL;
+  }
+}
+
+int is_valid_turn(Dir current, Dir d) {
+  switch(d) {
+    case UP:
+    case DOWN:
+      return current == LEFT || current == RIGHT;
+    case LEFT:
+    case RIGHT:
+      return current == UP || current == DOWN;
+    default:
+      return 0;
+  }
+}
+
+char dir_to_char(Dir m) {
+  switch(m) {
+    case LEFT:
+      return 'a';
+      break;
+    case RIGHT:
+      return 'd';
+      break;
+    case UP:
+      return 'w';
+      break;
+    case DOWN:
+      return 's';
+      break;
+    case NIL:
+      return 'a';
+      break;
+  }
+  return 'a';
+}
+
+void reset_env(Board* b, SnakeData* s) {
+  reset_board(b);
+  reset_snake(s, b);
+}
+
+/* Fresh board with the engine seeded and the first food placed, the common
+ * starting point of games, training episodes and replays.
+ */
+void start_episode(Board* b, SnakeData* s, uint32_t seed) {
+  reset_env(b, s);
+  seed_board(b, seed);
+  while(b->food == 0) {
+    generate_food(b, -1);
+  }
+}
+
+void execute_move(SnakeData *s, Dir move) {
+  set_snake_direction(dir_to_char(move), s); 
+}
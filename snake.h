@@ -0,0 +1,92 @@
+#ifndef SNAKE_H
+#define SNAKE_H
+
+#include <stdint.h>
+
+/* Snake engine. All state lives in a Board and a SnakeData, so any number
+ * of independent games can run side by side.
+ */
+
+#define MAX_FOOD 1
+
+typedef enum {
+  UP = 0,
+  DOWN = 1,
+  LEFT = 2,
+  RIGHT = 3,
+  NIL,
+} Dir;
+
+typedef struct {
+  int x;
+  int y;
+} Point;
+
+typedef struct {
+  Dir **dirMap;
+  Point start;
+  Point end;
+  int tummy;
+  int animation;
+  Dir direction;
+  int dead;       // the last update ran into a wall or the snake itself
+  int ate;        // the last update ate food
+} SnakeData;
+
+typedef enum {
+  Empty,
+  Snake,
+  Food,
+  Border,
+} BoardField;
+
+typedef struct {
+  BoardField **map;
+  int size_x;
+  int size_y;
+  int food;
+  uint32_t rng;
+} Board;
+
+/* Copy of a whole game. Board and snake grids are single blocks, so saving
+ * and restoring is one memcpy each plus the scalar fields.
+ */
+typedef struct {
+  Board board;
+  SnakeData snake;
+  BoardField* cells;
+  Dir* dirs;
+  int n_cells;
+} Snapshot;
+
+uint32_t board_rand(Board* b);
+void seed_board(Board* b, uint32_t seed);
+void generate_food(Board*b, int prob);
+
+void init_empty_board(Board* b, int size_x, int size_y);
+void reset_board(Board* b);
+void free_board(Board* b);
+
+void init_snake(SnakeData* snake, Board* b);
+void reset_snake(SnakeData* snake, Board* b);
+void free_snake(SnakeData* s, int board_size_y);
+
+void init_snapshot(Snapshot* snap, Board* b);
+void free_snapshot(Snapshot* snap);
+void save_state(Snapshot* snap, Board* b, SnakeData* s);
+void restore_state(Snapshot* snap, Board* b, SnakeData* s);
+
+/* Moves the snake one field in its direction. Returns the reward of the
+ * step: -500 for dying, 100 for eating and -1 otherwise.
+ */
+int update_snake(SnakeData* s, Board* b);
+void set_snake_direction(char c, SnakeData* s);
+void execute_move(SnakeData *s, Dir move);
+Dir reverse_dir(Dir d);
+int is_valid_turn(Dir current, Dir d);
+char dir_to_char(Dir m);
+
+void reset_env(Board* b, SnakeData* s);
+void start_episode(Board* b, SnakeData* s, uint32_t seed);
+
+#endif
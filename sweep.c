@@ -0,0 +1,304 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "sweep.h"
+#include "train.h"
+#include "util.h"
+
+/* Parses a comma separated list like "16,32,64". Every value has to be
+ * finite and within [lo, hi], with `integer` set also a whole number; pass
+ * lo = FLT_MIN for values that must be strictly positive. Returns 0 on
+ * bad input.
+ */
+int parse_axis(SweepAxis* a, const char* list, float lo, float hi, int integer) {
+  a->n = 0;
+  const char* p = list;
+  while(*p != '\0') {
+    if(a->n == SWEEP_MAX_VALUES) return 0;
+    char* end;
+    float v = strtof(p, &end);
+    if(end == p || (*end != ',' && *end != '\0')) return 0;
+    if(!isfinite(v) || v < lo || v > hi) return 0;
+    if(integer && v != (int)v) return 0;
+    a->values[a->n++] = v;
+    p = *end == ',' ? end + 1 : end;
+  }
+  return a->n > 0;
+}
+
+/* Parses a comma separated list of hidden shapes like "64x32,48".
+ * Returns 0 on bad input.
+ */
+int parse_hidden_axis(HiddenAxis* a, const char* list) {
+  a->n = 0;
+  const char* p = list;
+  while(*p != '\0') {
+    if(a->n == SWEEP_MAX_VALUES) return 0;
+    char item[256];
+    size_t len = strcspn(p, ",");
+    if(len >= sizeof(item)) return 0;
+    memcpy(item, p, len);
+    item[len] = '\0';
+    a->depth[a->n] = parse_widths(item, a->widths[a->n]);
+    if(a->depth[a->n] == 0) return 0;
+    a->n++;
+    p += len;
+    if(*p == ',') p++;
+  }
+  return a->n > 0;
+}
+
+/* Worker count for -j, a positive int. Returns 0 on bad input.
+ */
+static int parse_workers(const char* arg) {
+  char* end;
+  errno = 0;
+  long n = strtol(arg, &end, 10);
+  if(end == arg || *end != '\0' || errno != 0 || n <= 0 || n > INT_MAX) {
+    return 0;
+  }
+  return (int)n;
+}
+
+/* Reads the sweep arguments following "sweep N". Every axis that is not
+ * given sweeps only over the default of a fresh Trainer.
+ */
+int parse_sweep(Sweep* sw, Trainer* defaults, int argc, char** argv) {
+  sw->dir = "sweep";
+  sw->workers = 0;
+  sw->hidden.n = 1;
+  sw->hidden.depth[0] = defaults->depth;
+  memcpy(sw->hidden.widths[0], defaults->hidden, sizeof(defaults->hidden));
+  sw->decay = (SweepAxis){.values = {defaults->decay}, .n = 1};
+  sw->batch = (SweepAxis){.values = {defaults->batch_size}, .n = 1};
+  sw->gamma = (SweepAxis){.values = {defaults->gamma}, .n = 1};
+  sw->lr = (SweepAxis){.values = {defaults->lr}, .n = 1};
+
+  for(int arg = 0; arg < argc; arg++) {
+    if(arg + 1 >= argc) return 0;
+    const char* opt = argv[arg];
+    const char* val = argv[++arg];
+    int ok = 1;
+    if(strcmp(opt, "-o") == 0) {
+      sw->dir = val;
+    } else if(strcmp(opt, "-j") == 0) {
+      sw->workers = parse_workers(val);
+      ok = sw->workers > 0;
+    } else if(strcmp(opt, "--hidden") == 0) {
+      ok = parse_hidden_axis(&sw->hidden, val);
+    } else if(strcmp(opt, "--decay") == 0) {
+      ok = parse_axis(&sw->decay, val, FLT_MIN, 1.0f, 0);
+    } else if(strcmp(opt, "--batch") == 0) {
+      ok = parse_axis(&sw->batch, val, 1.0f, SWEEP_MAX_INT, 1);
+    } else if(strcmp(opt, "--gamma") == 0) {
+      ok = parse_axis(&sw->gamma, val, 0.0f, 1.0f, 0);
+    } else if(strcmp(opt, "--lr") == 0) {
+      ok = parse_axis(&sw->lr, val, FLT_MIN, FLT_MAX, 0);
+    } else {
+      ok = 0;
+    }
+    if(!ok) return 0;
+  }
+  return 1;
+}
+
+/* Cartesian product of all axes, each configuration with its own seed.
+ * Returns the number of configurations.
+ */
+int build_grid(Sweep* sw, SweepConfig** grid) {
+  int n = sw->hidden.n * sw->decay.n * sw->batch.n * sw->gamma.n * sw->lr.n;
+  *grid = malloc(n * sizeof(SweepConfig));
+  if(*grid == NULL) {
+    exit_program("Malloc error");
+  }
+  int id = 0;
+  for(int h = 0; h < sw->hidden.n; h++)
+  for(int d = 0; d < sw->decay.n; d++)
+  for(int b = 0; b < sw->batch.n; b++)
+  for(int g = 0; g < sw->gamma.n; g++)
+  for(int l = 0; l < sw->lr.n; l++) {
+    (*grid)[id] = (SweepConfig){
+      .id = id,
+      .depth = sw->hidden.depth[h],
+      .decay = sw->decay.values[d],
+      .batch = (int)sw->batch.values[b],
+      .gamma = sw->gamma.values[g],
+      .lr = sw->lr.values[l],
+      .seed = rand(),
+    };
+    memcpy((*grid)[id].hidden, sw->hidden.widths[h], sizeof((*grid)[id].hidden));
+    id++;
+  }
+  return n;
+}
+
+/* One headless training run. Telemetry goes to DIR/run_<id>.csv and the
+ * trained model to DIR/run_<id>.model.
+ */
+void run_config(Sweep* sw, SweepConfig* c, SweepResult* r) {
+  char csv[512], checkpoint[512];
+  snprintf(csv, sizeof(csv), "%s/run_%d.csv", sw->dir, c->id);
+  snprintf(checkpoint, sizeof(checkpoint), "%s/run_%d.model", sw->dir, c->id);
+
+  // the engine seeds every episode from rand, so this fixes the whole run
+  srand(c->seed);
+  Trainer t;
+  init_trainer(&t);
+  memcpy(t.hidden, c->hidden, sizeof(t.hidden));
+  t.depth = c->depth;
+  t.decay = c->decay;
+  t.batch_size = c->batch;
+  t.gamma = c->gamma;
+  t.lr = c->lr;
+  t.rng = c->seed;
+  t.init_rng = c->seed | 1;
+  t.checkpoint = checkpoint;
+  t.telemetry.out = fopen(csv, "w");
+  if(t.telemetry.out == NULL) {
+    exit_program("Could not open telemetry file %s", csv);
+  }
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  train(&t, sw->n_iters, 0);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  r->id = c->id;
+  r->mean_length = t.telemetry.last_length;
+  r->mean_reward = t.telemetry.last_reward;
+  r->mean_score = t.telemetry.last_score;
+  r->mean_loss = t.telemetry.last_loss;
+  r->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+
+  fclose(t.telemetry.out);
+  free_trainer(&t);
+}
+
+/* Runs every configuration of the grid. At most one worker runs per core
+ * the process may use, each pinned to its core, and a new one is forked
+ * as soon as a worker exits. Returns the number of failed runs.
+ */
+int run_sweep(Sweep* sw) {
+  if(mkdir(sw->dir, 0755) != 0 && errno != EEXIST) {
+    exit_program("Could not create sweep directory %s", sw->dir);
+  }
+
+  cpu_set_t allowed;
+  if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    exit_program("sched_getaffinity failed");
+  }
+  int n_cpus = 0;
+  int cpus[CPU_SETSIZE];
+  for(int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if(CPU_ISSET(cpu, &allowed)) cpus[n_cpus++] = cpu;
+  }
+
+  SweepConfig* grid;
+  int n = build_grid(sw, &grid);
+  int workers = sw->workers > 0 && sw->workers < n_cpus ? sw->workers : n_cpus;
+  if(workers > n) workers = n;
+
+  char path[512];
+  snprintf(path, sizeof(path), "%s/summary.csv", sw->dir);
+  FILE* summary = fopen(path, "w");
+  if(summary == NULL) {
+    exit_program("Could not open summary file %s", path);
+  }
+  fprintf(summary, "id,hidden,decay,batch,gamma,lr,seed,episodes,mean_length,"
+          "mean_reward,mean_score,mean_loss,seconds,checkpoint\n");
+  printf("%d runs of %d episodes on %d workers\n", n, sw->n_iters, workers);
+
+  // worker slot i runs on cpus[i]; pid 0 marks a free slot
+  pid_t* pids = calloc(workers, sizeof(pid_t));
+  int* pipes = calloc(workers, sizeof(int));
+  int* jobs = calloc(workers, sizeof(int));
+  if(pids == NULL || pipes == NULL || jobs == NULL) {
+    exit_program("Malloc error");
+  }
+
+  int next = 0, running = 0, failed = 0;
+  while(next < n || running > 0) {
+    for(int slot = 0; slot < workers && next < n; slot++) {
+      if(pids[slot] != 0) continue;
+      int fd[2];
+      if(pipe(fd) != 0) {
+        exit_program("pipe failed");
+      }
+      // buffered output would otherwise be written by every child again
+      fflush(NULL);
+      pid_t pid = fork();
+      if(pid < 0) {
+        exit_program("fork failed");
+      }
+      if(pid == 0) {
+        close(fd[0]);
+        cpu_set_t core;
+        CPU_ZERO(&core);
+        CPU_SET(cpus[slot], &core);
+        sched_setaffinity(0, sizeof(core), &core);
+
+        SweepResult r;
+        run_config(sw, &grid[next], &r);
+        // a single write below PIPE_BUF never blocks on an empty pipe
+        int ok = write(fd[1], &r, sizeof(r)) == (ssize_t)sizeof(r);
+        _exit(ok ? 0 : 1);
+      }
+      close(fd[1]);
+      pids[slot] = pid;
+      pipes[slot] = fd[0];
+      jobs[slot] = next++;
+      running++;
+    }
+
+    int status;
+    pid_t pid = waitpid(-1, &status, 0);
+    if(pid < 0) {
+      if(errno == EINTR) continue;
+      exit_program("waitpid failed");
+    }
+    int slot = 0;
+    while(slot < workers && pids[slot] != pid) slot++;
+    if(slot == workers) continue;
+
+    SweepConfig* c = &grid[jobs[slot]];
+    SweepResult r;
+    if(WIFEXITED(status) && WEXITSTATUS(status) == 0 &&
+       read(pipes[slot], &r, sizeof(r)) == (ssize_t)sizeof(r)) {
+      char hidden[128];
+      format_widths(hidden, sizeof(hidden), c->hidden, c->depth);
+      fprintf(summary, "%d,%s,%g,%d,%g,%g,%u,%d,%.2f,%.2f,%.3f,%.4g,%.2f,"
+              "%s/run_%d.model\n",
+              c->id, hidden, c->decay, c->batch, c->gamma, c->lr, c->seed,
+              sw->n_iters, r.mean_length, r.mean_reward, r.mean_score,
+              r.mean_loss, r.seconds, sw->dir, c->id);
+      fflush(summary);
+      printf("run %d done on cpu %d: score %.3f, %.1fs\n",
+             c->id, cpus[slot], r.mean_score, r.seconds);
+    } else {
+      fprintf(stderr, "run %d failed\n", c->id);
+      failed++;
+    }
+    close(pipes[slot]);
+    pids[slot] = 0;
+    running--;
+  }
+
+  fclose(summary);
+  free(pids);
+  free(pipes);
+  free(jobs);
+  free(grid);
+  return failed;
+}
@@ -0,0 +1,69 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <stdint.h>
+
+#include "train.h"
+
+/* Hyperparameter sweep: the cartesian product of the value lists is run as
+ * headless training jobs in forked workers, one per core, and the final
+ * metrics of every run are collected into DIR/summary.csv.
+ */
+
+#define SWEEP_MAX_VALUES 16
+#define SWEEP_MAX_INT 65536  // largest batch size
+
+typedef struct {
+  float values[SWEEP_MAX_VALUES];
+  int n;
+} SweepAxis;
+
+/* Hidden layer shapes, each a list of widths like 64x32.
+ */
+typedef struct {
+  int widths[SWEEP_MAX_VALUES][MAX_HIDDEN];
+  int depth[SWEEP_MAX_VALUES];
+  int n;
+} HiddenAxis;
+
+typedef struct {
+  int n_iters;
+  const char* dir;
+  int workers;
+  HiddenAxis hidden;
+  SweepAxis decay;
+  SweepAxis batch;
+  SweepAxis gamma;
+  SweepAxis lr;
+} Sweep;
+
+typedef struct {
+  int id;
+  int hidden[MAX_HIDDEN];
+  int depth;
+  float decay;
+  int batch;
+  float gamma;
+  float lr;
+  uint32_t seed;
+} SweepConfig;
+
+/* What a worker sends back to the parent through its pipe.
+ */
+typedef struct {
+  int id;
+  double mean_length;
+  double mean_reward;
+  double mean_score;
+  double mean_loss;
+  double seconds;
+} SweepResult;
+
+int parse_axis(SweepAxis* a, const char* list, float lo, float hi, int integer);
+int parse_hidden_axis(HiddenAxis* a, const char* list);
+int parse_sweep(Sweep* sw, Trainer* defaults, int argc, char** argv);
+int build_grid(Sweep* sw, SweepConfig** grid);
+void run_config(Sweep* sw, SweepConfig* c, SweepResult* r);
+int run_sweep(Sweep* sw);
+
+#endif
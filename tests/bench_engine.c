@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "snake.h"
+#include "util.h"
+
+/* Micro-benchmarks of the engine hot paths. Every number is the best of
+ * REPEATS timed runs, in nanoseconds per call.
+ */
+
+#define REPEATS 5
+#define N_GAMES 2000
+#define MAX_MOVES 1000
+#define N_CALLS 2000000
+#define FOOD_PROB 10
+
+double now_ns() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+void report(const char* name, double best, long calls) {
+  printf("%-14s %8.2f ns/call  (%ld calls)\n", name, best / calls, calls);
+}
+
+/* Recorded games: per move the direction and the field food was placed on
+ * afterwards, or -1. Replaying them needs neither a policy nor
+ * generate_food, so the timed loop is update_snake and little else.
+ */
+typedef struct {
+  uint32_t seeds[N_GAMES];
+  int lengths[N_GAMES];
+  Dir moves[N_GAMES][MAX_MOVES];
+  int food[N_GAMES][MAX_MOVES];
+} Recording;
+
+/* Plays games with a policy that mostly avoids walls and the body, so the
+ * snake grows and dies the way it does in training.
+ */
+void record_games(Recording* r, Board* b, SnakeData* s) {
+  uint32_t rng = 2463534242u;
+  BoardField* before = malloc(b->size_x * b->size_y * sizeof(BoardField));
+  if(before == NULL) {
+    fprintf(stderr, "Malloc error\n");
+    exit(1);
+  }
+  for(int g = 0; g < N_GAMES; g++) {
+    r->seeds[g] = xorshift32(&rng);
+    start_episode(b, s, r->seeds[g]);
+    int n = 0;
+    while(!s->dead && n < MAX_MOVES) {
+      Dir d = (Dir)(xorshift32(&rng) % 4);
+      for(int k = 0; k < 4 && xorshift32(&rng) % 50 != 0; k++) {
+        Dir c = (Dir)((d + k) % 4);
+        if(c != s->direction && !is_valid_turn(s->direction, c)) continue;
+        Point p = s->start;
+        p.x += c == RIGHT ? 1 : c == LEFT ? -1 : 0;
+        p.y += c == DOWN ? 1 : c == UP ? -1 : 0;
+        if(b->map[p.y][p.x] != Snake && b->map[p.y][p.x] != Border) {
+          d = c;
+          break;
+        }
+      }
+      execute_move(s, d);
+      r->moves[g][n] = s->direction;
+      update_snake(s, b);
+
+      memcpy(before, b->map[0], b->size_x * b->size_y * sizeof(BoardField));
+      generate_food(b, FOOD_PROB);
+      r->food[g][n] = -1;
+      for(int i = 0; i < b->size_x * b->size_y; i++) {
+        if(b->map[0][i] != before[i]) r->food[g][n] = i;
+      }
+      n++;
+    }
+    r->lengths[g] = n;
+  }
+  free(before);
+}
+
+/* Times all recorded games and returns the nanoseconds spent in the move
+ * loops. Setting up each game is not timed.
+ */
+double replay_games(Recording* r, Board* b, SnakeData* s, long* calls) {
+  double total = 0;
+  *calls = 0;
+  for(int g = 0; g < N_GAMES; g++) {
+    start_episode(b, s, r->seeds[g]);
+    double t = now_ns();
+    for(int i = 0; i < r->lengths[g]; i++) {
+      s->direction = r->moves[g][i];
+      update_snake(s, b);
+      if(r->food[g][i] >= 0) {
+        b->map[0][r->food[g][i]] = Food;
+        b->food++;
+      }
+    }
+    total += now_ns() - t;
+    *calls += r->lengths[g];
+    // a replay that leaves the recording would time something else
+    if(s->dead != (r->lengths[g] < MAX_MOVES)) {
+      fprintf(stderr, "game %d diverged from its recording\n", g);
+      exit(1);
+    }
+  }
+  return total;
+}
+
+int main() {
+  Board b;
+  init_empty_board(&b, 10, 10);
+  SnakeData s;
+  init_snake(&s, &b);
+  Snapshot empty;
+  init_snapshot(&empty, &b);
+
+  Recording* rec = malloc(sizeof(Recording));
+  if(rec == NULL) {
+    fprintf(stderr, "Malloc error\n");
+    return 1;
+  }
+  record_games(rec, &b, &s);
+
+  double best = 1e300;
+  long calls = 0;
+  for(int r = 0; r < REPEATS; r++) {
+    double t = replay_games(rec, &b, &s, &calls);
+    if(t < best) best = t;
+  }
+  report("update_snake", best, calls);
+
+  // food is never counted, so every call that passes the probability check
+  // draws a field; the board is cleaned up every 32 calls so food does not
+  // pile up; the engine stream keeps running across the cleanups, else
+  // the same 32 draws would repeat
+  reset_env(&b, &s);
+  save_state(&empty, &b, &s);
+  best = 1e300;
+  for(int r = 0; r < REPEATS; r++) {
+    double t = now_ns();
+    for(int i = 0; i < N_CALLS; i++) {
+      generate_food(&b, FOOD_PROB);
+      b.food = 0;
+      if(i % 32 == 31) {
+        uint32_t rng = b.rng;
+        restore_state(&empty, &b, &s);
+        b.rng = rng;
+      }
+    }
+    t = now_ns() - t;
+    if(t < best) best = t;
+  }
+  report("generate_food", best, N_CALLS);
+
+  best = 1e300;
+  for(int r = 0; r < REPEATS; r++) {
+    double t = now_ns();
+    for(int i = 0; i < N_CALLS; i++) {
+      reset_env(&b, &s);
+    }
+    t = now_ns() - t;
+    if(t < best) best = t;
+  }
+  report("reset_env", best, N_CALLS);
+
+  free(rec);
+  free_snapshot(&empty);
+  free_snake(&s, b.size_y);
+  free_board(&b);
+  return 0;
+}
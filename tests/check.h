@@ -0,0 +1,33 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdio.h>
+
+/* Minimal assertions shared by the test programs: CHECK counts failures
+ * and prints the first 20, check_summary ends main with the verdict.
+ */
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do {                                   \
+    if(!(cond)) {                                               \
+      if(failures++ < 20) {                                     \
+        printf("%s:%d: %s: ", __FILE__, __LINE__, #cond);       \
+        printf(__VA_ARGS__);                                    \
+        printf("\n");                                           \
+      }                                                         \
+    }                                                           \
+  } while(0)
+
+/* Prints the verdict and returns the exit status for main.
+ */
+static inline int check_summary(void) {
+  if(failures > 0) {
+    printf("%d checks failed\n", failures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}
+
+#endif
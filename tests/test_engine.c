@@ -0,0 +1,240 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "snake.h"
+#include "util.h"
+#include "episode.h"
+#include "check.h"
+
+/* Property tests for the engine: random games on boards of several sizes,
+ * checking the state after every step against what the reward says
+ * happened. Exits non-zero if any check failed.
+ */
+
+#define N_GAMES 1000
+#define MAX_STEPS 2000
+
+Point step_point(Point p, Dir d) {
+  switch(d) {
+    case UP: p.y--; break;
+    case DOWN: p.y++; break;
+    case LEFT: p.x--; break;
+    case RIGHT: p.x++; break;
+    default: break;
+  }
+  return p;
+}
+
+/* Walks the body from the tail along dirMap and returns its length, or -1
+ * if the walk leaves the board or does not reach the head.
+ */
+int body_length(Board* b, SnakeData* s, uint8_t* on_body) {
+  memset(on_body, 0, b->size_x * b->size_y);
+  Point p = s->end;
+  for(int len = 1; len <= b->size_x * b->size_y; len++) {
+    if(p.x < 0 || p.y < 0 || p.x >= b->size_x || p.y >= b->size_y) {
+      return -1;
+    }
+    on_body[p.y * b->size_x + p.x] = 1;
+    if(p.x == s->start.x && p.y == s->start.y) return len;
+    p = step_point(p, s->dirMap[p.y][p.x]);
+  }
+  return -1;
+}
+
+/* Invariants of a live game: the body is a connected path of tummy + 2
+ * fields, exactly the body is marked Snake and has a direction, the border
+ * is intact and the food counter matches the Food fields.
+ */
+void check_state(Board* b, SnakeData* s, uint8_t* on_body, const char* where) {
+  int len = body_length(b, s, on_body);
+  CHECK(len == s->tummy + 2, "%s: body length %d, tummy %d", where, len, s->tummy);
+  if(len < 0) return;
+
+  int food = 0;
+  for(int y = 0; y < b->size_y; y++) {
+    for(int x = 0; x < b->size_x; x++) {
+      int border = x == 0 || y == 0 || x == b->size_x - 1 || y == b->size_y - 1;
+      int body = on_body[y * b->size_x + x];
+      BoardField f = b->map[y][x];
+      food += f == Food;
+      CHECK(border == (f == Border), "%s: field (%d,%d) is %d", where, x, y, f);
+      CHECK(body == (f == Snake), "%s: field (%d,%d) is %d, on body %d",
+            where, x, y, f, body);
+      CHECK(body == (s->dirMap[y][x] != NIL), "%s: direction at (%d,%d) is %d",
+            where, x, y, s->dirMap[y][x]);
+    }
+  }
+  CHECK(food == b->food, "%s: %d food fields, counter says %d", where, food, b->food);
+  CHECK(b->food <= MAX_FOOD + 1, "%s: %d food on the board", where, b->food);
+}
+
+/* Mostly avoids walls and the body, so games get long enough for the
+ * snake to grow, but sometimes walks into them on purpose.
+ */
+Dir random_move(Board* b, SnakeData* s, uint32_t* rng) {
+  Dir d = (Dir)(xorshift32(rng) % 4);
+  if(xorshift32(rng) % 50 == 0) return d;
+  for(int k = 0; k < 4; k++) {
+    Dir c = (Dir)((d + k) % 4);
+    // execute_move ignores reversals, the snake then keeps going straight
+    Dir taken = c == s->direction || is_valid_turn(s->direction, c) ? c : s->direction;
+    Point p = step_point(s->start, taken);
+    if(b->map[p.y][p.x] != Snake && b->map[p.y][p.x] != Border) return c;
+  }
+  return d;
+}
+
+/* Plays one random game and checks every transition. Returns the trace
+ * hash so games can be compared.
+ */
+uint32_t random_game(Board* b, SnakeData* s, uint32_t seed, uint32_t* moves_rng,
+                     uint8_t* on_body, int* steps) {
+  start_episode(b, s, seed);
+  check_state(b, s, on_body, "start");
+  uint32_t hash = TRACE_INIT;
+
+  int step = 0;
+  for(; step < MAX_STEPS && !s->dead; step++) {
+    int prob = (int)(xorshift32(moves_rng) % 102) - 1;
+    execute_move(s, random_move(b, s, moves_rng));
+
+    Point next = step_point(s->start, s->direction);
+    BoardField target = b->map[next.y][next.x];
+    int tummy = s->tummy;
+    int food = b->food;
+    Point end = s->end;
+
+    int reward = update_snake(s, b);
+    hash = trace_step(hash, b, s, reward);
+
+    if(target == Snake || target == Border) {
+      CHECK(reward == -500 && s->dead && !s->ate,
+            "ran into %d: reward %d, dead %d", target, reward, s->dead);
+      break;
+    }
+    CHECK(!s->dead, "died on field %d", target);
+    CHECK(s->start.x == next.x && s->start.y == next.y, "head did not move");
+    if(target == Food) {
+      CHECK(reward == 100 && s->ate, "ate: reward %d", reward);
+      CHECK(s->tummy == tummy + 1 && b->food == food - 1,
+            "ate: tummy %d -> %d, food %d -> %d", tummy, s->tummy, food, b->food);
+      CHECK(s->end.x == end.x && s->end.y == end.y, "ate: tail moved");
+    } else {
+      CHECK(reward == -1 && !s->ate, "empty field: reward %d", reward);
+      CHECK(s->tummy == tummy && b->food == food,
+            "empty field: tummy %d -> %d", tummy, s->tummy);
+    }
+
+    generate_food(b, prob);
+    check_state(b, s, on_body, "step");
+  }
+  *steps = step;
+  return hash;
+}
+
+void test_random_games(int size_x, int size_y) {
+  Board b;
+  init_empty_board(&b, size_x, size_y);
+  SnakeData s;
+  init_snake(&s, &b);
+  uint8_t* on_body = malloc(size_x * size_y);
+
+  uint32_t rng = 0x9e3779b9u;
+  long steps = 0, deaths = 0, score = 0;
+  for(int game = 0; game < N_GAMES; game++) {
+    uint32_t seed = xorshift32(&rng);
+    uint32_t moves = seed ^ 0x5bd1e995u;
+    int n;
+    uint32_t hash = random_game(&b, &s, seed, &moves, on_body, &n);
+    steps += n;
+    deaths += s.dead;
+    score += s.tummy;
+
+    // the same seed and moves have to give the same trajectory
+    moves = seed ^ 0x5bd1e995u;
+    int again;
+    CHECK(random_game(&b, &s, seed, &moves, on_body, &again) == hash && again == n,
+          "game %d with seed %u is not deterministic", game, seed);
+  }
+  printf("random games %dx%d: %d games, %ld steps, %ld deaths, %ld food eaten\n",
+         size_x, size_y, N_GAMES, steps, deaths, score);
+
+  free(on_body);
+  free_snake(&s, b.size_y);
+  free_board(&b);
+}
+
+/* Restoring a snapshot has to undo any number of steps exactly.
+ */
+void test_snapshot() {
+  Board b;
+  init_empty_board(&b, 10, 10);
+  SnakeData s;
+  init_snake(&s, &b);
+  Snapshot snap, check;
+  init_snapshot(&snap, &b);
+  init_snapshot(&check, &b);
+
+  uint32_t rng = 12345;
+  for(int game = 0; game < 200; game++) {
+    start_episode(&b, &s, xorshift32(&rng));
+    for(int i = 0; i < 5 && !s.dead; i++) {
+      execute_move(&s, (Dir)(xorshift32(&rng) % 4));
+      update_snake(&s, &b);
+      generate_food(&b, 10);
+    }
+    if(s.dead) continue;
+    save_state(&snap, &b, &s);
+    save_state(&check, &b, &s);
+    for(int i = 0; i < 20 && !s.dead; i++) {
+      execute_move(&s, (Dir)(xorshift32(&rng) % 4));
+      update_snake(&s, &b);
+      generate_food(&b, 10);
+    }
+    restore_state(&snap, &b, &s);
+    CHECK(memcmp(b.map[0], check.cells, check.n_cells * sizeof(BoardField)) == 0,
+          "game %d: board differs after restore", game);
+    CHECK(memcmp(s.dirMap[0], check.dirs, check.n_cells * sizeof(Dir)) == 0,
+          "game %d: directions differ after restore", game);
+    CHECK(b.rng == check.board.rng && b.food == check.board.food &&
+          s.tummy == check.snake.tummy && s.dead == check.snake.dead &&
+          s.start.x == check.snake.start.x && s.start.y == check.snake.start.y &&
+          s.end.x == check.snake.end.x && s.end.y == check.snake.end.y &&
+          s.direction == check.snake.direction,
+          "game %d: fields differ after restore", game);
+  }
+  printf("snapshot: ok\n");
+
+  free_snapshot(&snap);
+  free_snapshot(&check);
+  free_snake(&s, b.size_y);
+  free_board(&b);
+}
+
+/* Turns that are not reversals survive the 2-bit log encoding.
+ */
+void test_turn_encoding() {
+  Dir dirs[] = {UP, DOWN, LEFT, RIGHT};
+  for(int i = 0; i < 4; i++) {
+    for(int j = 0; j < 4; j++) {
+      if(dirs[i] != dirs[j] && !is_valid_turn(dirs[i], dirs[j])) continue;
+      Dir d = decode_turn(dirs[i], encode_turn(dirs[i], dirs[j]));
+      CHECK(d == dirs[j], "turn %c -> %c decodes to %c",
+            dir_to_char(dirs[i]), dir_to_char(dirs[j]), dir_to_char(d));
+    }
+  }
+  printf("turn encoding: ok\n");
+}
+
+int main() {
+  test_random_games(10, 10);
+  test_random_games(6, 6);
+  test_random_games(20, 12);
+  test_snapshot();
+  test_turn_encoding();
+
+  return check_summary();
+}
@@ -0,0 +1,81 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "nn.h"
+#include "util.h"
+#include "check.h"
+
+/* Checkpoint round trip: a model saved and loaded into a freshly
+ * initialised model of the same shape has to give identical weights and
+ * outputs. Exits non-zero if any check failed.
+ */
+
+int same_matrix(Matrix* A, Matrix* B) {
+  if(A == NULL || B == NULL) return A == B;
+  if(A->rows != B->rows || A->cols != B->cols) return 0;
+  for(int i = 0; i < A->rows; i++) {
+    for(int j = 0; j < A->cols; j++) {
+      if(A->mat[i][j] != B->mat[i][j]) return 0;
+    }
+  }
+  return 1;
+}
+
+void build(Model* m, int conv, uint32_t seed) {
+  uint32_t rng = seed;
+  if(conv) {
+    int channels[] = {4, 6};
+    init_cnn(m, 10, 10, channels, 2, &rng);
+  } else {
+    int hidden[] = {24, 12};
+    init_mlp(m, 10, 10, hidden, 2, &rng);
+  }
+}
+
+void test_round_trip(int conv, const char* path) {
+  Model saved, loaded;
+  build(&saved, conv, 12345);
+  build(&loaded, conv, 54321);
+  save_model(&saved, path);
+  load_model(&loaded, path);
+
+  for(int i = 0; i < saved.n_layers; i++) {
+    CHECK(same_matrix(saved.layers[i].W, loaded.layers[i].W) &&
+          same_matrix(saved.layers[i].b, loaded.layers[i].b),
+          "%s layer %d differs after loading", conv ? "cnn" : "mlp", i);
+  }
+
+  uint32_t rng = 777;
+  Matrix* X = alloc_matrix(10, 10);
+  Matrix* out = alloc_matrix(4, 1);
+  for(int round = 0; round < 10; round++) {
+    rand_matrix(X, -1.0f, 1.0f, &rng);
+    copy_matrix(forward(&saved, X), out);
+    CHECK(same_matrix(out, forward(&loaded, X)),
+          "%s outputs differ after loading", conv ? "cnn" : "mlp");
+  }
+  printf("%s checkpoint: ok\n", conv ? "cnn" : "mlp");
+
+  release_matrix(out);
+  release_matrix(X);
+  free_model(&saved);
+  free_model(&loaded);
+}
+
+int main() {
+  char path[] = "/tmp/csnake_model_XXXXXX";
+  int fd = mkstemp(path);
+  if(fd < 0) {
+    perror("mkstemp");
+    return 1;
+  }
+  close(fd);
+
+  test_round_trip(0, path);
+  test_round_trip(1, path);
+  unlink(path);
+
+  return check_summary();
+}
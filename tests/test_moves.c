@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "nn.h"
+#include "train.h"
+#include "util.h"
+#include "check.h"
+
+/* Checks the SIMD argmax against a scalar reference on awkward values and
+ * column counts, and that epsilon-greedy selection never reverses the
+ * snake. Exits non-zero if any check failed.
+ */
+
+/* Mostly a handful of repeated values so ties are common, plus NaN and
+ * both infinities.
+ */
+float awkward_value(uint32_t* rng) {
+  switch(xorshift32(rng) % 8) {
+    case 0: return NAN;
+    case 1: return -INFINITY;
+    case 2: return INFINITY;
+    default: return (float)(xorshift32(rng) % 3) - 1.0f;
+  }
+}
+
+int argmax_reference(Matrix* Q, int j, int skip) {
+  int best_id = skip == 0 ? 1 : 0;
+  float best = -INFINITY;
+  for(int r = 0; r < Q->rows; r++) {
+    if(r != skip && Q->mat[r][j] > best) {
+      best = Q->mat[r][j];
+      best_id = r;
+    }
+  }
+  return best_id;
+}
+
+void test_argmax_cols() {
+  uint32_t rng = 0x1234567u;
+  int checked = 0;
+  for(int n = 1; n <= 37; n++) {
+    Matrix* Q = alloc_matrix(4, n);
+    int* skip = malloc(n * sizeof(int));
+    int* out = malloc(n * sizeof(int));
+    for(int round = 0; round < 200; round++) {
+      for(int j = 0; j < n; j++) {
+        for(int r = 0; r < 4; r++) Q->mat[r][j] = awkward_value(&rng);
+        skip[j] = (int)(xorshift32(&rng) % 5) - 1;
+      }
+      argmax_cols(Q, skip, out);
+      for(int j = 0; j < n; j++) {
+        int want = argmax_reference(Q, j, skip[j]);
+        CHECK(out[j] == want, "n %d column %d skip %d: got row %d, want %d",
+              n, j, skip[j], out[j], want);
+        checked++;
+      }
+    }
+    free(out);
+    free(skip);
+    release_matrix(Q);
+  }
+  printf("argmax_cols: %d columns checked\n", checked);
+}
+
+void test_select_moves() {
+  // more than one SELECT_BATCH chunk, and not a multiple of 4
+  int n = 2 * SELECT_BATCH + 7;
+  Matrix* Q = alloc_matrix(4, n);
+  Dir* current = malloc(n * sizeof(Dir));
+  Dir* moves = malloc(n * sizeof(Dir));
+  uint32_t rng = 0xdeadbeefu;
+  uint32_t counter = 0;
+  float eps[] = {0.0f, 0.3f, 1.0f};
+  long picks = 0;
+
+  for(int e = 0; e < 3; e++) {
+    for(int round = 0; round < 200; round++) {
+      for(int j = 0; j < n; j++) {
+        for(int r = 0; r < 4; r++) Q->mat[r][j] = awkward_value(&rng);
+        current[j] = (Dir)(xorshift32(&rng) % 5);
+      }
+      select_moves(Q, current, n, eps[e], &counter, moves);
+      for(int j = 0; j < n; j++) {
+        CHECK(moves[j] <= RIGHT, "eps %g: move %d is not a direction",
+              eps[e], moves[j]);
+        CHECK(current[j] == NIL || moves[j] != reverse_dir(current[j]),
+              "eps %g: picked %c, the reverse of %c", eps[e],
+              dir_to_char(moves[j]), dir_to_char(current[j]));
+        picks++;
+      }
+    }
+  }
+  printf("select_moves: %ld picks checked\n", picks);
+
+  free(moves);
+  free(current);
+  release_matrix(Q);
+}
+
+int main() {
+  test_argmax_cols();
+  test_select_moves();
+
+  return check_summary();
+}
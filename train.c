@@ -0,0 +1,417 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "train.h"
+#include "episode.h"
+#include "util.h"
+
+Matrix* board_to_matrix(Board* b) {
+  Matrix* mat = alloc_matrix(b->size_y, b->size_x);
+  for(int i = 0; i < mat->rows; i++) {
+    for(int j = 0; j < mat->cols; j++) {
+      switch(b->map[i][j]) {
+        case Border:
+          mat->mat[i][j] = -1.0;
+          break;
+        case Snake:
+          mat->mat[i][j] = 1.0;
+          break;
+        case Empty:
+          mat->mat[i][j] = 0.0;
+          break;
+        case Food:
+          mat->mat[i][j] = 1.0;
+          break;
+      }
+    }
+  }
+  return mat;
+}
+
+/* Counter based hash (lowbias32), so a whole batch of random numbers can
+ * be drawn in one vectorizable loop.
+ */
+uint32_t mix32(uint32_t x) {
+  x ^= x >> 16;
+  x *= 0x7feb352du;
+  x ^= x >> 15;
+  x *= 0x846ca68bu;
+  x ^= x >> 16;
+  return x;
+}
+
+/* Epsilon-greedy over a 4 x n matrix of Q-values, one column per state.
+ * current[j] is the direction of snake j; its reverse is never picked, as
+ * set_snake_direction would ignore it anyway. The trainer plays a single
+ * snake and passes n = 1; batch_targets feeds whole minibatches to
+ * argmax_cols instead.
+ */
+void select_moves(Matrix* Q, const Dir* current, int n, float eps,
+                  uint32_t* rng, Dir* moves) {
+  uint32_t draws[SELECT_BATCH];
+  int skip[SELECT_BATCH];
+  int best[SELECT_BATCH];
+
+  if(Q->rows != 4) {
+    exit_program("Expected one Q-value row per move, got %d rows", Q->rows);
+  }
+
+  for(int start = 0; start < n; start += SELECT_BATCH) {
+    int len = n - start < SELECT_BATCH ? n - start : SELECT_BATCH;
+    Matrix chunk = {.rows = Q->rows, .cols = len, .mat = Q->mat};
+    float* rows[4];
+    if(start > 0) {
+      for(int i = 0; i < Q->rows; i++) rows[i] = Q->mat[i] + start;
+      chunk.mat = rows;
+    }
+
+    for(int j = 0; j < len; j++) {
+      draws[j] = mix32(*rng + j);
+      skip[j] = current[start + j] == NIL ? -1 : (int)reverse_dir(current[start + j]);
+    }
+    *rng += len;
+
+    argmax_cols(&chunk, skip, best);
+
+    for(int j = 0; j < len; j++) {
+      // top 16 bits decide exploring, the low 16 bits pick the random
+      // move by multiply-shift, which unlike % 3 favours no move
+      float u = (draws[j] >> 16) * (1.0f / 65536.0f);
+      uint32_t r = draws[j] & 0xffff;
+      int a = best[j];
+      if(u < eps) {
+        if(skip[j] < 0) {
+          a = (int)((r * 4) >> 16);
+        } else {
+          a = (int)((r * 3) >> 16);
+          if(a >= skip[j]) a++;
+        }
+      }
+      moves[start + j] = (Dir)a;
+    }
+  }
+}
+
+void init_minibatch(Minibatch* mb, int n) {
+  mb->exps = malloc(n * sizeof(Exp*));
+  mb->targets = malloc(n * sizeof(float));
+  mb->skip = malloc(n * sizeof(int));
+  mb->best = malloc(n * sizeof(int));
+  mb->Q_next = alloc_matrix(4, n);
+  if(mb->exps == NULL || mb->targets == NULL || mb->skip == NULL ||
+     mb->best == NULL || mb->Q_next == NULL) {
+    exit_program("Malloc error");
+  }
+  for(int j = 0; j < n; j++) {
+    mb->skip[j] = -1;
+  }
+}
+
+void free_minibatch(Minibatch* mb) {
+  free(mb->exps);
+  free(mb->targets);
+  free(mb->skip);
+  free(mb->best);
+  release_matrix(mb->Q_next);
+  mb->Q_next = NULL;
+}
+
+/* TD targets of the first n sampled memories: the next-state Q-values go
+ * into one column each and a single argmax_cols finds all of their
+ * maxima. The max is floored at 0 and NaNs are ignored. All targets come
+ * from the weights before this minibatch's updates.
+ */
+void batch_targets(Model* m, Minibatch* mb, int n, float gamma) {
+  Matrix* Q = mb->Q_next;
+  for(int j = 0; j < n; j++) {
+    Exp* e = mb->exps[j];
+    Matrix* q = e->done ? NULL : forward(m, e->new_state);
+    for(int i = 0; i < Q->rows; i++) {
+      Q->mat[i][j] = q != NULL ? q->mat[i][0] : 0.0f;
+    }
+  }
+
+  Matrix view = {.rows = Q->rows, .cols = n, .mat = Q->mat};
+  argmax_cols(&view, mb->skip, mb->best);
+
+  for(int j = 0; j < n; j++) {
+    Exp* e = mb->exps[j];
+    float max_q = Q->mat[mb->best[j]][j];
+    mb->targets[j] = e->reward;
+    if(!e->done) {
+      mb->targets[j] += gamma * (max_q > 0.0f ? max_q : 0.0f);
+    }
+  }
+}
+
+void add_experience(ExpArray* arr, Exp e) {
+  if(arr->size == MAX_EXP_SIZE) {
+    // full, the slot we overwrite holds the oldest memory
+    release_matrix(arr->arr[arr->id].old_state);
+    release_matrix(arr->arr[arr->id].new_state);
+  } else {
+    arr->size++;
+  }
+  arr->arr[arr->id] = e;
+  arr->id = (arr->id + 1) % MAX_EXP_SIZE;
+}
+
+Exp* sample_experience(ExpArray* rep_buffer) {
+  return &rep_buffer->arr[rand() % rep_buffer->size];
+}
+
+/* One gradient step on a single memory towards its TD target, returns
+ * its squared TD error.
+ */
+float backward(Model* m, Exp* batch, float target, float lr) {
+  Matrix* Q_pred = forward(m, batch->old_state);
+  float Q_sa = Q_pred->mat[batch->move][0];
+
+  if(m->grad == NULL) {
+    m->grad = alloc_matrix(Q_pred->rows, Q_pred->cols);
+  }
+
+  // only the taken action contributes to the loss
+  zero_matrix(m->grad);
+  m->grad->mat[batch->move][0] = 2 * (Q_sa - target);
+  backprop(m, m->grad, lr);
+  return (Q_sa - target) * (Q_sa - target);
+}
+
+static const char* phase_names[] = {"step", "encode", "forward", "sample", "backward"};
+
+uint64_t read_cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();
+#else
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t)t.tv_sec * 1000000000u + t.tv_nsec;
+#endif
+}
+
+/* Charges the time since *t to phase p and restarts the stopwatch.
+ */
+void lap(Telemetry* tm, Phase p, uint64_t* t) {
+  uint64_t now = read_cycles();
+  tm->cycles[p] += now - *t;
+  *t = now;
+}
+
+void reset_telemetry(Telemetry* tm) {
+  for(int p = 0; p < N_PHASES; p++) {
+    tm->cycles[p] = 0;
+  }
+  tm->steps = 0;
+  tm->episodes = 0;
+  tm->reward = 0;
+  tm->score = 0;
+  tm->loss = 0.0;
+  tm->updates = 0;
+  clock_gettime(CLOCK_MONOTONIC, &tm->since);
+}
+
+/* Records the per-episode means of the current window and, if there is an
+ * output file, writes them as one CSV line together with the per-step
+ * phase costs. Then starts a new window.
+ */
+void emit_telemetry(Telemetry* tm, int iter, float eps) {
+  if(tm->episodes == 0) {
+    reset_telemetry(tm);
+    return;
+  }
+  tm->last_length = (double)tm->steps / tm->episodes;
+  tm->last_reward = (double)tm->reward / tm->episodes;
+  tm->last_score = (double)tm->score / tm->episodes;
+  tm->last_loss = tm->updates > 0 ? tm->loss / tm->updates : 0.0;
+
+  if(tm->out != NULL) {
+    if(ftell(tm->out) == 0) {
+      fprintf(tm->out, "episode,episodes,mean_length,mean_reward,"
+              "mean_score,mean_loss,epsilon,elapsed_ms");
+      for(int p = 0; p < N_PHASES; p++) {
+        fprintf(tm->out, ",%s_cycles", phase_names[p]);
+      }
+      fprintf(tm->out, "\n");
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = (now.tv_sec - tm->since.tv_sec) * 1e3 +
+                     (now.tv_nsec - tm->since.tv_nsec) * 1e-6;
+    long steps = tm->steps > 0 ? tm->steps : 1;
+
+    fprintf(tm->out, "%d,%ld,%.2f,%.2f,%.3f,%.4g,%.4f,%.1f", iter,
+            tm->episodes, tm->last_length, tm->last_reward, tm->last_score,
+            tm->last_loss, eps, elapsed);
+    for(int p = 0; p < N_PHASES; p++) {
+      fprintf(tm->out, ",%.0f", (double)tm->cycles[p] / steps);
+    }
+    fprintf(tm->out, "\n");
+    fflush(tm->out);
+  }
+  reset_telemetry(tm);
+}
+
+/* Parses hidden widths like "64x32", input side first. Returns the number
+ * of layers, or 0 unless every width is a whole number in [1, MAX_WIDTH].
+ */
+int parse_widths(const char* s, int* widths) {
+  int depth = 0;
+  const char* p = s;
+  for(;;) {
+    if(depth == MAX_HIDDEN || *p < '0' || *p > '9') return 0;
+    char* end;
+    errno = 0;
+    long w = strtol(p, &end, 10);
+    if(errno != 0 || w < 1 || w > MAX_WIDTH) return 0;
+    widths[depth++] = (int)w;
+    if(*end == '\0') return depth;
+    if(*end != 'x') return 0;
+    p = end + 1;
+  }
+}
+
+void format_widths(char* buf, size_t size, const int* widths, int depth) {
+  size_t len = 0;
+  buf[0] = '\0';
+  for(int i = 0; i < depth && len < size; i++) {
+    len += snprintf(buf + len, size - len, i == 0 ? "%d" : "x%d", widths[i]);
+  }
+}
+
+void init_trainer(Trainer* t) {
+  t->replay = calloc(1, sizeof(ExpArray));
+  if(t->replay == NULL) {
+    exit_program("Malloc error");
+  }
+  t->exploration = 0.5;
+  t->decay = 0.9999;
+  t->gamma = 0.3;
+  t->lr = 0.1;
+  t->hidden[0] = 48;
+  t->depth = 1;
+  t->rng = rand();
+  t->init_rng = rand() | 1;
+  t->batch_size = 7;
+  t->conv_net = 0;
+  t->frame = (struct timespec){.tv_sec = 0, .tv_nsec = 300000000L};
+  t->episode_log = NULL;
+  t->render = NULL;
+  t->checkpoint = NULL;
+  t->telemetry.out = NULL;
+  t->telemetry.last_length = 0.0;
+  t->telemetry.last_reward = 0.0;
+  t->telemetry.last_score = 0.0;
+  t->telemetry.last_loss = 0.0;
+  reset_telemetry(&t->telemetry);
+}
+
+void free_trainer(Trainer* t) {
+  for(size_t i = 0; i < t->replay->size; i++) {
+    release_matrix(t->replay->arr[i].old_state);
+    release_matrix(t->replay->arr[i].new_state);
+  }
+  free(t->replay);
+  t->replay = NULL;
+}
+
+void run_simulation(Trainer* t, Board* b, SnakeData *s, int verbose, int iter) {
+  uint32_t seed = rand();
+  start_episode(b, s, seed);
+
+  Episode episode = {0};
+  begin_episode(&episode, b, seed, 10);
+
+  long total_reward = 0;
+  while(!s->dead) {
+    uint64_t stamp = read_cycles();
+    Matrix *s_before = board_to_matrix(b);
+    lap(&t->telemetry, PhaseEncode, &stamp);
+    Matrix *out = forward(&t->model, s_before);
+    Dir move;
+    select_moves(out, &s->direction, 1, t->exploration, &t->rng, &move);
+    t->exploration *= t->decay;
+    lap(&t->telemetry, PhaseForward, &stamp);
+
+    execute_move(s, move);
+    int reward = update_snake(s, b);
+    record_move(&episode, b, s, reward);
+    int done = s->dead;
+    generate_food(b, 10);
+    total_reward += reward;
+    lap(&t->telemetry, PhaseStep, &stamp);
+
+    Matrix* s_after = board_to_matrix(b);
+    lap(&t->telemetry, PhaseEncode, &stamp);
+
+    Exp new_experience = {.old_state=s_before, .new_state=s_after, 
+                          .done=done, .reward=reward, .move=move};
+
+    add_experience(t->replay, new_experience);
+
+    int batch = t->replay->size < (size_t)t->batch_size ? (int)t->replay->size : t->batch_size;
+    for(int i = 0; i < batch; i++) {
+      t->minibatch.exps[i] = sample_experience(t->replay);
+    }
+    lap(&t->telemetry, PhaseSample, &stamp);
+    batch_targets(&t->model, &t->minibatch, batch, t->gamma);
+    for(int i = 0; i < batch; i++) {
+      t->telemetry.loss += backward(&t->model, t->minibatch.exps[i],
+                                    t->minibatch.targets[i], t->lr);
+      t->telemetry.updates++;
+    }
+    lap(&t->telemetry, PhaseBackward, &stamp);
+    t->telemetry.steps++;
+
+    if(verbose && t->render != NULL) {
+      t->render(b, s, iter, move);
+      nanosleep(&t->frame, NULL);
+    }
+  }
+  t->telemetry.episodes++;
+  t->telemetry.reward += total_reward;
+  t->telemetry.score += s->tummy;
+
+  end_episode(&episode, s, s->dead, t->episode_log);
+  free_episode(&episode);
+  return;
+}
+
+/* 
+ * model 
+ * params
+ */
+void train(Trainer* t, int n_iters, int verbose) {
+  Board b;
+  init_empty_board(&b, 10, 10);
+  SnakeData snake;
+  init_snake(&snake, &b);
+
+  if(t->conv_net) {
+    int channels[] = {8, 8};
+    init_cnn(&t->model, b.size_y, b.size_x, channels, 2, &t->init_rng);
+  } else {
+    init_mlp(&t->model, b.size_y, b.size_x, t->hidden, t->depth, &t->init_rng);
+  }
+
+  init_minibatch(&t->minibatch, t->batch_size);
+  int log_every = max((int)(n_iters / 10), 1);
+
+  reset_telemetry(&t->telemetry);
+  for(int iter = 1; iter <= n_iters; iter++) {
+    run_simulation(t, &b, &snake, verbose, iter);
+    if(iter % log_every == 0 || iter == n_iters) {
+      emit_telemetry(&t->telemetry, iter, t->exploration);
+    }
+  }
+
+  if(t->checkpoint != NULL) {
+    save_model(&t->model, t->checkpoint);
+  }
+  free_minibatch(&t->minibatch);
+  free_model(&t->model);
+  free_snake(&snake, b.size_y);
+  free_board(&b);
+}
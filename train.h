@@ -0,0 +1,119 @@
+#ifndef TRAIN_H
+#define TRAIN_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "nn.h"
+#include "snake.h"
+
+#define MAX_EXP_SIZE 100000
+#define SELECT_BATCH 64
+#define MAX_HIDDEN 8        // hidden layers of the MLP
+#define MAX_WIDTH 65536     // units per hidden layer
+
+typedef struct {
+  Matrix* old_state;
+  Matrix* new_state;
+  int reward;
+  int done;
+  Dir move;
+} Exp;
+
+/* Scratch for one replay minibatch of up to batch_size memories.
+ */
+typedef struct {
+  Exp** exps;
+  float* targets;
+  int* skip;          // all -1, the target max runs over every move
+  int* best;
+  Matrix* Q_next;     // next-state Q-values, one column per memory
+} Minibatch;
+
+/* Ring buffer of memories, the oldest one is dropped once it is full.
+ */
+typedef struct {
+  Exp arr[MAX_EXP_SIZE];
+  size_t id;
+  size_t size;
+} ExpArray;
+
+typedef enum {
+  PhaseStep,
+  PhaseEncode,
+  PhaseForward,
+  PhaseSample,
+  PhaseBackward,
+  N_PHASES,
+} Phase;
+
+/* Training statistics accumulated since the last emitted line. Timers
+ * count TSC cycles on x86 and nanoseconds elsewhere.
+ */
+typedef struct {
+  uint64_t cycles[N_PHASES];
+  long steps;
+  long episodes;
+  long reward;
+  long score;
+  double loss;
+  long updates;
+  struct timespec since;
+  FILE* out;
+  // means of the last emitted window
+  double last_length;
+  double last_reward;
+  double last_score;
+  double last_loss;
+} Telemetry;
+
+/* Everything one DQN training run needs. Set the knobs after init_trainer
+ * and before train.
+ */
+typedef struct {
+  Model model;
+  ExpArray* replay;
+  float exploration;       // probability of a random move
+  float decay;             // exploration is multiplied by this every step
+  float gamma;
+  float lr;
+  int hidden[MAX_HIDDEN];  // hidden widths of the MLP, input side first
+  int depth;               // number of hidden layers
+  uint32_t rng;            // counter for select_moves
+  uint32_t init_rng;       // xorshift32 state for the initial weights
+  int batch_size;
+  Minibatch minibatch;     // allocated by train for batch_size memories
+  int conv_net;
+  struct timespec frame;   // delay between verbose frames
+  FILE* episode_log;       // episodes are appended here if set
+  void (*render)(Board* b, SnakeData* s, int iter, Dir move);  // verbose frames
+  const char* checkpoint;  // the trained model is saved here if set
+  Telemetry telemetry;
+} Trainer;
+
+void add_experience(ExpArray* arr, Exp e);
+Exp* sample_experience(ExpArray* rep_buffer);
+Matrix* board_to_matrix(Board* b);
+uint32_t mix32(uint32_t x);
+void select_moves(Matrix* Q, const Dir* current, int n, float eps,
+                  uint32_t* rng, Dir* moves);
+void init_minibatch(Minibatch* mb, int n);
+void free_minibatch(Minibatch* mb);
+void batch_targets(Model* m, Minibatch* mb, int n, float gamma);
+float backward(Model* m, Exp* batch, float target, float lr);
+
+uint64_t read_cycles();
+void lap(Telemetry* tm, Phase p, uint64_t* t);
+void reset_telemetry(Telemetry* tm);
+void emit_telemetry(Telemetry* tm, int iter, float eps);
+
+int parse_widths(const char* s, int* widths);
+void format_widths(char* buf, size_t size, const int* widths, int depth);
+
+void init_trainer(Trainer* t);
+void free_trainer(Trainer* t);
+void run_simulation(Trainer* t, Board* b, SnakeData *s, int verbose, int iter);
+void train(Trainer* t, int n_iters, int verbose);
+
+#endif
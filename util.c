@@ -0,0 +1,22 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+
+#include "util.h"
+
+void exit_program(const char* message, ...) {
+  va_list args;
+  va_start(args, message);
+
+  char buffer[512];
+  vsnprintf(buffer, sizeof(buffer), message, args);
+  va_end(args);
+
+  fprintf(stderr, "Error: %s\n", buffer);
+  exit(1);
+}
+
+float rand_float(uint32_t* rng, float a, float b) {
+  // top 24 bits, exactly representable as a float in [0, 1]
+  return a + (b - a) * ((xorshift32(rng) >> 8) / 16777215.0f);
+}
@@ -0,0 +1,31 @@
+#ifndef UTIL_H
+#define UTIL_H
+
+#include <stdint.h>
+
+#define max(a,b) \
+   ({ __typeof__ (a) _a = (a); \
+       __typeof__ (b) _b = (b); \
+     _a > _b ? _a : _b; })
+
+/* Prints the formatted message to stderr and exits with status 1. Cleanup
+ * such as restoring the terminal belongs in atexit handlers.
+ */
+void exit_program(const char* message, ...);
+
+/* xorshift32 step on a caller-owned, non-zero state, so every object
+ * drawing random numbers has its own stream. Inline, as board_rand and
+ * the planner rollouts call it once per step.
+ */
+static inline uint32_t xorshift32(uint32_t* state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return x;
+}
+
+float rand_float(uint32_t* rng, float a, float b);
+
+#endif